@@ -0,0 +1,144 @@
+// Synthetic labeled graph generator for the benchmark suite.
+// Output follows the input format of run (see README):
+//   <Vertex ID> <Vertex Label> \t <Neighbor 1 ID> <Neighbor 1 Label> ...
+//
+// Usage:
+//   gen_graph -type er|rmat|grid -n <#vertices> [-m <#edges>] [-labels <k>]
+//             [-seed <s>] -o <output file>
+// er: Erdos-Renyi G(n, m); rmat: R-MAT power-law (a,b,c,d = .57,.19,.19,.05);
+// grid: 4-neighbor sqrt(n) x sqrt(n) grid (-m is ignored).
+// Labels are drawn uniformly from the first k letters of [a-zA-Z].
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+using namespace std;
+
+const char* ALPHABET = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+string getOption(int argc, char** argv, const char* option, const char* def)
+{
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], option) == 0)
+            return argv[i + 1];
+    return def;
+}
+
+void add_edge(vector<vector<int> >& adj, int u, int v)
+{
+    if (u == v)
+        return;
+    adj[u].push_back(v);
+    adj[v].push_back(u);
+}
+
+void gen_er(vector<vector<int> >& adj, long long m, mt19937_64& rng)
+{
+    uniform_int_distribution<int> pick(0, adj.size() - 1);
+    for (long long i = 0; i < m; i++)
+        add_edge(adj, pick(rng), pick(rng));
+}
+
+void gen_rmat(vector<vector<int> >& adj, long long m, mt19937_64& rng)
+{
+    const double a = 0.57, b = 0.19, c = 0.19;
+    int n = adj.size();
+    int scale = 0;
+    while ((1LL << scale) < n)
+        scale++;
+    uniform_real_distribution<double> coin(0.0, 1.0);
+    for (long long i = 0; i < m; i++) {
+        int u = 0, v = 0;
+        for (int s = 0; s < scale; s++) {
+            double r = coin(rng);
+            u <<= 1;
+            v <<= 1;
+            if (r < a)
+                ;
+            else if (r < a + b)
+                v |= 1;
+            else if (r < a + b + c)
+                u |= 1;
+            else {
+                u |= 1;
+                v |= 1;
+            }
+        }
+        if (u < n && v < n)
+            add_edge(adj, u, v);
+    }
+}
+
+void gen_grid(vector<vector<int> >& adj)
+{
+    int n = adj.size();
+    int side = (int)sqrt((double)n);
+    for (int i = 0; i < side * side; i++) {
+        int r = i / side, c = i % side;
+        if (c + 1 < side)
+            add_edge(adj, i, i + 1);
+        if (r + 1 < side)
+            add_edge(adj, i, i + side);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    string type = getOption(argc, argv, "-type", "er");
+    int n = atoi(getOption(argc, argv, "-n", "1000").c_str());
+    long long m = atoll(getOption(argc, argv, "-m", "0").c_str());
+    int k = atoi(getOption(argc, argv, "-labels", "4").c_str());
+    unsigned long long seed = atoll(getOption(argc, argv, "-seed", "1").c_str());
+    string out = getOption(argc, argv, "-o", "");
+    if (m == 0)
+        m = 4LL * n;
+    if (k < 1 || k > (int)strlen(ALPHABET) || n < 1 || out == "") {
+        fprintf(stderr, "Usage: %s -type er|rmat|grid -n <#vertices> [-m <#edges>] "
+                        "[-labels <1-52>] [-seed <s>] -o <output file>\n", argv[0]);
+        return 1;
+    }
+
+    mt19937_64 rng(seed);
+    vector<vector<int> > adj(n);
+    if (type == "er")
+        gen_er(adj, m, rng);
+    else if (type == "rmat")
+        gen_rmat(adj, m, rng);
+    else if (type == "grid")
+        gen_grid(adj);
+    else {
+        fprintf(stderr, "Unknown graph type %s\n", type.c_str());
+        return 1;
+    }
+
+    uniform_int_distribution<int> pick_label(0, k - 1);
+    vector<char> label(n);
+    for (int i = 0; i < n; i++)
+        label[i] = ALPHABET[pick_label(rng)];
+
+    FILE* f = fopen(out.c_str(), "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s for writing!\n", out.c_str());
+        return 1;
+    }
+    long long edges = 0;
+    for (int i = 0; i < n; i++) {
+        vector<int>& nbs = adj[i];
+        sort(nbs.begin(), nbs.end());
+        nbs.erase(unique(nbs.begin(), nbs.end()), nbs.end());
+        edges += nbs.size();
+        // vertex IDs are 1-based as in graphs/toy.txt
+        fprintf(f, "%d %c\t", i + 1, label[i]);
+        for (size_t j = 0; j < nbs.size(); j++)
+            fprintf(f, "%s%d %c", (j == 0 ? "" : " "), nbs[j] + 1, label[nbs[j]]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    printf("%s: %d vertices, %lld edges, %d labels\n", out.c_str(), n, edges / 2, k);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#!/bin/bash
+# Reproducible benchmark of run on localhost.
+# Generates synthetic labeled graphs (bench/gen_graph), runs every query in
+# bench/queries on every graph with every rank count under mpiexec, and
+# appends one CSV line per run to bench/results/bench_<date>.csv:
+#   graph,query,ranks,mapping_count,load_data_s,load_query_s,build_tree_s,
+#   match_s,enum_s,compute_s,mappings_per_s,peak_rss_kb
+# peak_rss_kb is the maximum over ranks, taken from the -metrics export.
+#
+# Usage (from the repository root, after "make" (or "make local") and "make bench"):
+#   bench/run_bench.sh [-ranks "1 2 4"] [-size 100000] [-labels 4] [-seed 1]
+#                      [-graphs "er rmat grid"] [-queries "path4 star4 ..."]
+# Environment:
+#   INPUT=HDFS (default): graphs are put to $HDFS_DIR (default /bench) first.
+#   INPUT=local: graphs are read from bench/data (for "make local" builds).
+#   MPIEXEC: mpiexec command line prefix (default "mpiexec").
+
+set -e
+cd "$(dirname "$0")/.."
+
+RANKS="1 2 4"
+SIZE=100000
+LABELS=4
+SEED=1
+GRAPHS="er rmat grid"
+QUERIES=$(ls bench/queries | sed 's/\.txt$//')
+INPUT=${INPUT:-HDFS}
+HDFS_DIR=${HDFS_DIR:-/bench}
+MPIEXEC=${MPIEXEC:-mpiexec}
+
+while [ $# -gt 1 ]; do
+    case "$1" in
+        -ranks) RANKS="$2" ;;
+        -size) SIZE="$2" ;;
+        -labels) LABELS="$2" ;;
+        -seed) SEED="$2" ;;
+        -graphs) GRAPHS="$2" ;;
+        -queries) QUERIES="$2" ;;
+        *) echo "Unknown option $1"; exit 1 ;;
+    esac
+    shift 2
+done
+
+if [ ! -x ./run ] || [ ! -x bench/gen_graph ]; then
+    echo "Please run \"make\" and \"make bench\" first."
+    exit 1
+fi
+
+mkdir -p bench/data bench/results
+RESULT=bench/results/bench_$(date +%Y%m%d_%H%M%S).csv
+echo "graph,query,ranks,mapping_count,load_data_s,load_query_s,build_tree_s,match_s,enum_s,compute_s,mappings_per_s,peak_rss_kb" > $RESULT
+
+# extract "<title> : <x> seconds" from the master's output
+stage_time()
+{
+    grep "^$1 :" "$2" | head -1 | awk '{print $(NF-1)}'
+}
+
+for g in $GRAPHS; do
+    data=bench/data/${g}_n${SIZE}_l${LABELS}_s${SEED}.txt
+    [ -f $data ] || bench/gen_graph -type $g -n $SIZE -labels $LABELS -seed $SEED -o $data
+    data_path=$data
+    if [ "$INPUT" == "HDFS" ]; then
+        hadoop fs -mkdir -p $HDFS_DIR/queries
+        hadoop fs -put -f $data $HDFS_DIR/
+        data_path=$HDFS_DIR/$(basename $data)
+    fi
+
+    for q in $QUERIES; do
+        query_path=bench/queries/$q.txt
+        if [ "$INPUT" == "HDFS" ]; then
+            hadoop fs -put -f $query_path $HDFS_DIR/queries/
+            query_path=$HDFS_DIR/queries/$q.txt
+        fi
+
+        for n in $RANKS; do
+            log=bench/results/${g}_${q}_${n}.log
+            metrics=bench/results/${g}_${q}_${n}_metrics.csv
+            $MPIEXEC -n $n ./run -d $data_path -q $query_path -pseudo on \
+                -order degree -input $INPUT -metrics $metrics > $log 2>&1
+            count=$(grep "^Mapping count:" $log | awk '{print $3}')
+            load_data=$(stage_time "Loading data graph time" $log)
+            load_query=$(stage_time "Loading query graph time" $log)
+            build_tree=$(stage_time "Building query tree time" $log)
+            match=$(stage_time "Subgraph matching time" $log)
+            enum=$(stage_time "Subgraph enumeration time" $log)
+            compute=$(stage_time "COMPUTE Time" $log)
+            throughput=$(awk -v c="$count" -v t="$compute" 'BEGIN { if (t > 0) printf "%.1f", c / t; else print 0 }')
+            rss=$(awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) if ($i == "peak_rss_kb") c = i; next }
+                c && $c > m { m = $c } END { print m + 0 }' $metrics)
+            echo "$g,$q,$n,$count,$load_data,$load_query,$build_tree,$match,$enum,$compute,$throughput,$rss" | tee -a $RESULT
+        done
+    done
+done
+
+echo "Results written to $RESULT"
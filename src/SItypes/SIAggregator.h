@@ -9,8 +9,12 @@ class SIAgg : public Aggregator<AggMat, AggMat>
 	// agg_mat[u1, u1] = candidate(u1);
 	// agg_mat[u1, u2] = sum_i(|C'_{u1, vi}(u2)|), u1 < u2
 	// agg_mat[0, 0] = # mappings
+	// (timing goes to profiling zones, see utils/profile.h)
 public:
 	AggMat agg_mat;
+	int mode; // see sync_mode()
+
+	SIAgg(int m = AGG_POD) : mode(m) {}
 
     virtual void init()
     {
@@ -40,9 +44,43 @@ public:
     	return &agg_mat;
     }
 
-    void addTime(int index_x, int index_y, double time)
+    // AGG_POD by default, one allreduce of agg_mat, row by row (its shape
+    // is fixed by init()); stepFinal() merges into finishPartial(), so
+    // AGG_TREE and AGG_GATHER work too (-aggsync)
+    virtual int sync_mode()
+    {
+        return mode;
+    }
+
+    virtual int pod_size()
+    {
+    	int n = 0;
+    	for (int i = 0; i < agg_mat.size(); ++i)
+    		n += agg_mat[i].size();
+    	return n * sizeof(double);
+    }
+
+    virtual void to_pod(char* buf)
+    {
+    	double* d = (double*)buf;
+    	for (int i = 0; i < agg_mat.size(); ++i)
+			for (int j = 0; j < agg_mat[i].size(); ++j)
+				*d++ = agg_mat[i][j];
+    }
+
+    virtual void pod_combine(const char* in, char* inout)
+    {
+    	int n = pod_size() / sizeof(double);
+    	for (int i = 0; i < n; ++i)
+    		((double*)inout)[i] += ((const double*)in)[i];
+    }
+
+    virtual void from_pod(const char* buf)
     {
-        agg_mat[index_x][index_y] += time;
+    	const double* d = (const double*)buf;
+    	for (int i = 0; i < agg_mat.size(); ++i)
+			for (int j = 0; j < agg_mat[i].size(); ++j)
+				agg_mat[i][j] = *d++;
     }
 
     void addMappingCount(long count)
@@ -3,242 +3,214 @@
 
 #include "SItypes/SIQuery.h"
 //==========================================================================
+// Packed branch: a branch and, recursively, its children as one flat int
+// array with offsets relative to the start of each node, so that a branch
+// is sent with one memcpy, embedded as is into the pack of its parent and
+// read in place. Layout of a node (offsets in ints):
+//   header [BP_HEADER], mapping [ncol], child offsets [nchd],
+//   unmarked: nstate+1 prefix counts + (pi, k) pairs, marked: the same,
+//   trees [ntree * nstate], tree markers [ntree * W], conflux values
+//   [ntree * W], pseudo markers [npm * W], children
+// W is the number of words of a marker (see SItypes/SIMarker.h).
+// A (pi, k) pair refers to the k-th tree of child pi (for pseudo children,
+// it's vID + index in the pseudo markers). A tree picks for each state either its unmarked
+// branches (choice 0) or the group of marked branches starting at j
+// (choice j+1), see SIBranch::enumerateTrees.
+
+enum BRANCH_PACK {
+	BP_SIZE = 0,	// #ints of the node and its children
+	BP_NCOL,
+	BP_SELF,
+	BP_CURR_U,
+	BP_NSTATE,		// #children states (ordinary + pseudo)
+	BP_NCHD,		// #packed children
+	BP_NTREE,
+	BP_WORDS,		// W
+	BP_CHD,			// offsets of the sections
+	BP_UNMARKED,
+	BP_MARKED,
+	BP_TREES,
+	BP_TM,
+	BP_CV,
+	BP_PM,
+	BP_HEADER
+};
 
-struct SIBranch
+struct BranchView
 {
-	int *mapping;
-	int self;
-	int ncol;
-	int curr_u;
-	int T; // generated in enumerateTree
-	int mapping_marker; // not sent
-
-	vector<SIBranch*> chd_pointers;
-	// the following three all have length |#children|
-	// <pi, ti> (for pseudo, it's vID + marker)
-	vector<vector<pair<int, int>>> unmarked_branches;
-	vector<vector<pair<int, int>>> marked_branches;
-
-	vector<int> tree_indices; // valid tis
-	vector<int> tree_markers; // length of T
-	vector<int> conflux_values; // length of T
-
-	SIBranch() {};
-
-	SIBranch(int *mapping, int self, int ncol, int curr_u, int mapping_marker)
+	const int *p;
+
+	BranchView() : p(NULL) {}
+	BranchView(const int *p) : p(p) {}
+
+	int size() const { return p[BP_SIZE]; }
+	int ncol() const { return p[BP_NCOL]; }
+	int self() const { return p[BP_SELF]; }
+	int curr_u() const { return p[BP_CURR_U]; }
+	int nstate() const { return p[BP_NSTATE]; }
+	int ntree() const { return p[BP_NTREE]; }
+	int words() const { return p[BP_WORDS]; }
+
+	BranchView chd(int pi) const { return BranchView(p + p[p[BP_CHD] + pi]); }
+	int choice(int k, int si) const { return p[p[BP_TREES] + k * nstate() + si]; }
+	const int *treeMarker(int k) const { return p + p[BP_TM] + k * words(); }
+	const int *confluxValue(int k) const { return p + p[BP_CV] + k * words(); }
+
+	// area: BP_UNMARKED or BP_MARKED
+	int branchSize(int area, int si) const
 	{
-		SIQuery* query = (SIQuery*)getQuery();
-		if (ncol != 0)
-		{
-			this->mapping = new int[ncol];
-			for (int i = 0; i < ncol; i++)
-				this->mapping[i] = mapping[i];
-		}
-		this->self = self;
-		this->ncol = ncol;
-		this->curr_u = curr_u;
-		this->mapping_marker = mapping_marker;
-		int s = (query->getChdTypes(curr_u)).size();
-		this->unmarked_branches = vector<vector<pair<int, int>>>(s);
-		this->marked_branches = vector<vector<pair<int, int>>>(s);
+		const int *idx = p + p[area];
+		return idx[si+1] - idx[si];
 	}
 
-	vector<int> getStateRep(int ti)
+	pair<int, int> branch(int area, int si, int ci) const
 	{
-		vector<int> sr;
-		int T0 = this->T;
-		for (int bi = 0; bi < this->marked_branches.size(); bi++)
-		{
-			T0 /= (marked_branches[bi].size() + 1);
-			sr.push_back(ti / T0);
-			ti = ti % T0;			
-		}
-		return sr;
+		const int *idx = p + p[area];
+		const int *e = idx + nstate() + 1 + 2 * (idx[si] + ci);
+		return make_pair(e[0], e[1]);
 	}
 
-	inline int getChdType(int si)
-	{
-		SIQuery* query = (SIQuery*)getQuery();
-		return query->getChdTypes(this->curr_u)[si];
+	const int *branchMarker(int si, int j, int chd_type) const
+	{ // marker of the j-th marked branch of state si
+		pair<int, int> e = branch(BP_MARKED, si, j);
+		if (chd_type == 0) // ordinary child
+			return chd(e.first).treeMarker(e.second);
+		else
+			return p + p[BP_PM] + e.second * words();
 	}
 
-	int getChdMarker(int si, int ci)
-	{
-		if (ci == 0)
-			return 0;
+	int extractMapping(int index) const
+	{ // the final vertex is stored in self
+		if (index < ncol())
+			return p[BP_HEADER + index];
 		else
-		{
-			int chd_type = this->getChdType(si);
-			int pi = this->marked_branches[si][ci-1].first;
-			int ti = this->marked_branches[si][ci-1].second;
-			if (chd_type == 0) // ordinary child
-				return this->chd_pointers[pi]->tree_markers[ti];
-			else
-				return ti;
-		}
+			return self();
 	}
 
-	bool enumerateTrees(int cv)
+	int getChdType(int si) const
 	{
-		// this function fills tree indices, tree markers and conflux values
-		int s = this->unmarked_branches.size();
-		if (s == 0)
-		{
-			this->tree_indices.push_back(0);
-			this->tree_markers.push_back(this->mapping_marker);
-			this->conflux_values.push_back(0);
-			return true;
-		}
-
-		vector<int> v = vector<int>(s);
-		vector<int> ceil = vector<int>(s);
-		vector<int> blank_states = vector<int>();
-		this->T = 1;
-
-		for (int i = 0; i < s; i++)
-		{
-			int mi = this->marked_branches[i].size();
-			if (this->unmarked_branches[i].empty())
-				if (mi == 0) return false;
-				else blank_states.push_back(i);
-
-			ceil[i] = mi + 1;
-			this->T *= (mi + 1);
-		}
-		
-		this->tree_markers.resize(this->T);
-		this->conflux_values.resize(this->T);
-
-		for (int ti = 0; ti < T; ti++, v[s-1]++)
-		{
-			for (int j = s-1; v[j] == ceil[j]; v[j--] = 0, v[j]++);
-
-			bool flag = false;
-			for (int j : blank_states)
-			{ if (v[j] == 0) { flag = true; break;} }
-			if (flag) continue;
-			
-			this->tree_indices.push_back(ti);
-			int marker = this->mapping_marker;
-			for (int j = 0; j < s; j++)
-				marker += this->getChdMarker(j, v[j]);
-			
-			tree_markers[ti] = marker & (~cv);
-			conflux_values[ti] = marker & cv;
-		}
-
-		return true;
-	}
-
-	int extractMapping(int index)
-	{ // since the final vertex is stored in this->self,
-	  // this is a helper function to help extract the correct vertex
-		if (index < this->ncol)
-			return this->mapping[index];
-		else
-			return this->self;
+		SIQuery* query = (SIQuery*)getQuery();
+		return query->getChdTypes(curr_u())[si];
 	}
 
-	int extractConflictVertex(int ti, vector<int> index_chain_2)
+	int extractConflictVertex(int k, const vector<int> &index_chain_2) const
 	{
-		int ind = 0, si, ci, pi;
-		SIBranch *chd = this;
+		// the states on index_chain_2 are never grouped (see 
+		// SIBranch::enumerateTrees), a group there is one branch
+		int ind = 0, si, pi;
+		BranchView chd = *this;
 		while (ind < index_chain_2.size() - 1)
 		{
 			si = index_chain_2[ind];
-			ci = chd->getStateRep(ti)[si]; // > 1, since marked
-			pi = chd->marked_branches[si][ci-1].first;
-			ti = chd->marked_branches[si][ci-1].second;
+			int j = chd.choice(k, si) - 1; // >= 0, since marked
+			pair<int, int> e = chd.branch(BP_MARKED, si, j);
+			pi = e.first;
+			k = e.second;
 			if (index_chain_2[ind+1] == -1)
 				return pi;
 			else
-				chd = chd->chd_pointers[pi];
+				chd = chd.chd(pi);
 			ind ++;
 		}
-		return chd->extractMapping(index_chain_2[ind]);
+		return chd.extractMapping(index_chain_2[ind]);
 	}
 
-	long expand(int ti, vector<int> conflict_vs)
+	long expand(int k, vector<int> conflict_vs) const
 	{
-		// expand the ti-th tree in trees.
+		// expand the k-th tree in trees.
 		// recursively calls its children to expand.
-		// conflict_vs: vector of length k
+		// conflict_vs: vector of length #conflicts
 		SIQuery* query = (SIQuery*)getQuery();
-		vector<int> choices = this->getStateRep(ti);
+		int curr_u = this->curr_u();
 
-		vector<int> cis = query->getRelatedConflictIndices(this->curr_u);
+		IntSpan cis = query->getRelatedConflictIndices(curr_u);
 		for (int ci: cis)
 		{
-			//cout << "ci = " << ci << endl;
-			Conflict c = query->getConflict(ci);
-			if (this->curr_u == c.common_ancestor)
-				if ((this->conflux_values[ti] >> ci) & 1)
-					conflict_vs[ci] = this->extractConflictVertex(ti, c.index_chain_2);
+			const Conflict &c = query->getConflict(ci);
+			if (curr_u == c.common_ancestor)
+				if (marker_test(this->confluxValue(k), ci))
+					conflict_vs[ci] = this->extractConflictVertex(k, c.index_chain_2);
 			
-			if (this->curr_u == c.u1_state) // this is true only if !isPseudo(u1)
+			if (curr_u == c.u1_state) // this is true only if !isPseudo(u1)
 				if (this->extractMapping(c.index_chain_1[c.index_chain_1.size()-1]) 
 					== conflict_vs[ci]) 
 					return 0;
-
-			//cout << "conflict_vs[ci] = " << conflict_vs[ci] << endl;
 		}
 
+		IntSpan extract = query->getChdExtract(curr_u);
 		long count = 1;
-		for (int ci = 0; ci < choices.size(); ci++)
+		for (int ci = 0; ci < nstate(); ci++)
 		{
 			long count_ci = 0;
-			int choice_i = choices[ci];
+			int choice_i = this->choice(k, ci);
 			int chd_type = this->getChdType(ci);
 			if (choice_i == 0)
 			{ // unmarked branches
+				int n = branchSize(BP_UNMARKED, ci);
+				if (chd_type != 0 && query->getChdFolded(curr_u)[ci])
+					n = branch(BP_UNMARKED, ci, 0).first; // (count, 0)
 				if (chd_type == 0) // ordinary child
 				{
-					for (pair<int, int> p : this->unmarked_branches[ci])
+					for (int j = 0; j < n; j++)
 					{
-						count_ci += this->chd_pointers[p.first]->expand(
-							p.second, conflict_vs);
+						pair<int, int> p = branch(BP_UNMARKED, ci, j);
+						count_ci += this->chd(p.first).expand(p.second, conflict_vs);
 					}
 				}
 				else if (chd_type == 1) // pseudo child
 				{
-					int chd_sz = query->getChildren(this->curr_u).size();
-					int chd_u = query->getPseudoChildren(this->curr_u)[ci-chd_sz];
+					int chd_sz = query->getChildren(curr_u).size();
+					int chd_u = query->getPseudoChildren(curr_u)[ci-chd_sz];
 					vector<int> psd_conflict_vs;
 					for (int chd_ci : query->getRelatedConflictIndices(chd_u))
 						psd_conflict_vs.push_back(conflict_vs[chd_ci]);
 					if (psd_conflict_vs.empty())
-						count_ci = this->unmarked_branches[ci].size();
+						count_ci = n;
 					else
 					{
-						for (pair<int, int> p : this->unmarked_branches[ci])
+						for (int j = 0; j < n; j++)
 						{
+							int vID = branch(BP_UNMARKED, ci, j).first;
 							bool flag = true;
 							for (int cv : psd_conflict_vs)
-							{ if (p.first == cv) { flag = false; break; }}
+							{ if (vID == cv) { flag = false; break; }}
 							count_ci += flag;
 						}
 					}
 				}
 				else if (chd_type > 1) // multi-psd chd
-					count_ci = math_choose(this->unmarked_branches[ci].size(), chd_type);
+					count_ci = math_choose(n, chd_type) /
+						query->getSymDivisors(curr_u)[ci];
 				else
 					count_ci = 1;
 			}
-			else // marked branch (only one)
+			else // marked branches of one group, all with the same marker
 			{
-				pair<int, int> p = this->marked_branches[ci][choice_i-1];
-				if (chd_type == 0) // ordinary child
-					count_ci = this->chd_pointers[p.first]->expand(p.second, conflict_vs);
-				else // psd_chd
+				int first = choice_i-1, last = first+1;
+				if (!extract[ci])
 				{
-					int chd_sz = query->getChildren(this->curr_u).size();
-					int chd_u = query->getPseudoChildren(this->curr_u)[ci-chd_sz];
-					vector<int> psd_conflict_vs;									
-					count_ci = 1;
-					for (int chd_ci : query->getRelatedConflictIndices(chd_u))
+					int n = branchSize(BP_MARKED, ci);
+					const int *marker = branchMarker(ci, first, chd_type);
+					while (last < n && marker_equal(
+						branchMarker(ci, last, chd_type), marker, words()))
+						last ++;
+				}
+				int chd_sz = query->getChildren(curr_u).size();
+				for (int j = first; j < last; j++)
+				{
+					pair<int, int> p = branch(BP_MARKED, ci, j);
+					if (chd_type == 0) // ordinary child
+						count_ci += this->chd(p.first).expand(p.second, conflict_vs);
+					else // psd_chd
 					{
-						if (p.first == conflict_vs[chd_ci])
-							{ count_ci = 0; break; }
+						int chd_u = query->getPseudoChildren(curr_u)[ci-chd_sz];
+						bool flag = true;
+						for (int chd_ci : query->getRelatedConflictIndices(chd_u))
+						{
+							if (p.first == conflict_vs[chd_ci])
+								{ flag = false; break; }
+						}
+						count_ci += flag;
 					}
 				}
 			}
@@ -247,6 +219,239 @@ struct SIBranch
 		return count;
 	}
 
+	void print() const
+	{
+		cout << "~~~Printing Packed Branch~~~" << endl;
+		cout << "(Mapping) (" << ncol()+1 << ") [ ";
+		for (int i = 0; i < ncol(); i++)
+			cout << extractMapping(i) << ", ";
+		cout << self() << "]" << endl;
+		cout << "curr_u: " << curr_u() << " size: " << size() << endl;
+		cout << "tree_markers & conflux_values: " << endl;
+		for (int k = 0; k < ntree(); k++)
+		{
+			cout << "[k=" << k << "]: ";
+			marker_print(treeMarker(k), words());
+			cout << " | ";
+			marker_print(confluxValue(k), words());
+			cout << endl;
+		}
+	}
+};
+
+//==========================================================================
+
+struct SIBranch
+{
+	int *mapping; // followed by the marker of the mapping (not sent)
+	int self;
+	int ncol;
+	int curr_u;
+
+	vector<BranchView> chd_views; // packed children, in the received messages
+	// the following three all have length |#children|
+	// <pi, k> (for pseudo, it's vID + index in psd_markers)
+	vector<vector<pair<int, int>>> unmarked_branches;
+	vector<vector<pair<int, int>>> marked_branches;
+	vector<int> psd_markers; // W ints per marked pseudo child
+
+	// generated in enumerateTrees, only the valid trees
+	vector<int> tree_choices; // #trees * |#children|, see BranchView
+	vector<int> tree_markers; // #trees * W
+	vector<int> conflux_values; // #trees * W
+
+	SIBranch() {};
+
+	// mapping_marker: W ints, NULL for none
+	SIBranch(int *mapping, int self, int ncol, int curr_u, 
+		const int *mapping_marker)
+	{
+		SIQuery* query = (SIQuery*)getQuery();
+		int W = query->marker_words;
+		this->mapping = new int[ncol + W];
+		for (int i = 0; i < ncol; i++)
+			this->mapping[i] = mapping[i];
+		for (int i = 0; i < W; i++)
+			this->mapping[ncol + i] = 
+				(mapping_marker == NULL) ? 0 : mapping_marker[i];
+		this->self = self;
+		this->ncol = ncol;
+		this->curr_u = curr_u;
+		int s = (query->getChdTypes(curr_u)).size();
+		this->unmarked_branches = vector<vector<pair<int, int>>>(s);
+		this->marked_branches = vector<vector<pair<int, int>>>(s);
+	}
+
+	inline int getChdType(int si)
+	{
+		SIQuery* query = (SIQuery*)getQuery();
+		return query->getChdTypes(this->curr_u)[si];
+	}
+
+	// build_branch moves mapping and ncol together, the marker stays
+	const int *getMappingMarker()
+	{
+		return this->mapping + this->ncol;
+	}
+
+	// adds a marked pseudo child of state si
+	void addPsdMarked(int si, int vID, const int *marker)
+	{
+		int W = ((SIQuery*)getQuery())->marker_words;
+		int pm = this->psd_markers.size() / W;
+		marker_append(this->psd_markers, marker, W);
+		this->marked_branches[si].push_back(make_pair(vID, pm));
+	}
+
+	const int *getBranchMarker(int si, const pair<int, int> &e)
+	{
+		if (this->getChdType(si) == 0) // ordinary child
+			return this->chd_views[e.first].treeMarker(e.second);
+		else
+			return &this->psd_markers[0] + e.second 
+				* ((SIQuery*)getQuery())->marker_words;
+	}
+
+	bool enumerateTrees(const int *cv)
+	{
+		// this function fills the trees, tree markers and conflux values.
+		// A tree picks, for every state, the unmarked branches or one group
+		// of marked branches. The marked branches of a state are sorted and
+		// grouped by marker (expand sums over a group), unless a conflict
+		// vertex is extracted through them; only the valid trees are 
+		// enumerated, so their number follows the distinct markers, not
+		// the product of the marked branches.
+		SIQuery* query = (SIQuery*)getQuery();
+		int W = query->marker_words;
+		int s = this->unmarked_branches.size();
+		if (s == 0)
+		{
+			marker_append(this->tree_markers, this->getMappingMarker(), W);
+			marker_append(this->conflux_values, NULL, W);
+			return true;
+		}
+
+		IntSpan extract = query->getChdExtract(this->curr_u);
+		// choices[i]: the choices of state i, v[i]: the current one
+		vector<vector<int>> choices = vector<vector<int>>(s);
+		vector<int> v = vector<int>(s);
+
+		for (int i = 0; i < s; i++)
+		{
+			vector<pair<int, int>> &marked = this->marked_branches[i];
+			if (!this->unmarked_branches[i].empty())
+				choices[i].push_back(0);
+			if (!extract[i])
+				sort(marked.begin(), marked.end(), 
+					[this, i, W](const pair<int, int> &a, const pair<int, int> &b)
+					{ return marker_less(getBranchMarker(i, a), 
+						getBranchMarker(i, b), W); });
+			for (int j = 0; j < marked.size(); j++)
+				if (extract[i] || j == 0 || !marker_equal(getBranchMarker(i, 
+					marked[j]), getBranchMarker(i, marked[j-1]), W))
+					choices[i].push_back(j+1);
+			if (choices[i].empty()) return false;
+		}
+
+		vector<int> marker = vector<int>(W);
+		while (true)
+		{
+			const int *mm = this->getMappingMarker();
+			marker.assign(mm, mm + W);
+			for (int j = 0; j < s; j++)
+			{
+				int ci = choices[j][v[j]]; // 0 = unmarked, j+1 = group at j
+				this->tree_choices.push_back(ci);
+				if (ci > 0)
+					marker_or(&marker[0], &marker[0], 
+						this->getBranchMarker(j, this->marked_branches[j][ci-1]), W);
+			}
+			for (int w = 0; w < W; w++)
+			{
+				this->tree_markers.push_back(marker[w] & (~cv[w]));
+				this->conflux_values.push_back(marker[w] & cv[w]);
+			}
+
+			int j = s-1;
+			for (; j >= 0 && v[j] == choices[j].size() - 1; j--)
+				v[j] = 0;
+			if (j < 0) break;
+			v[j] ++;
+		}
+
+		return true;
+	}
+
+	// appends the packed branch to out, see BranchView
+	void pack(vector<int> &out)
+	{
+		int s = this->unmarked_branches.size();
+		int nchd = this->chd_views.size();
+		int n_unmarked = 0, n_marked = 0;
+		for (int si = 0; si < s; si++)
+		{
+			n_unmarked += this->unmarked_branches[si].size();
+			n_marked += this->marked_branches[si].size();
+		}
+		int W = ((SIQuery*)getQuery())->marker_words;
+		int ntree = this->tree_markers.size() / W;
+
+		int hdr[BP_HEADER];
+		hdr[BP_NCOL] = this->ncol;
+		hdr[BP_SELF] = this->self;
+		hdr[BP_CURR_U] = this->curr_u;
+		hdr[BP_NSTATE] = s;
+		hdr[BP_NCHD] = nchd;
+		hdr[BP_NTREE] = ntree;
+		hdr[BP_WORDS] = W;
+		hdr[BP_CHD] = BP_HEADER + this->ncol;
+		hdr[BP_UNMARKED] = hdr[BP_CHD] + nchd;
+		hdr[BP_MARKED] = hdr[BP_UNMARKED] + s + 1 + 2 * n_unmarked;
+		hdr[BP_TREES] = hdr[BP_MARKED] + s + 1 + 2 * n_marked;
+		hdr[BP_TM] = hdr[BP_TREES] + this->tree_choices.size();
+		hdr[BP_CV] = hdr[BP_TM] + ntree * W;
+		hdr[BP_PM] = hdr[BP_CV] + ntree * W;
+		int len = hdr[BP_PM] + this->psd_markers.size();
+		for (int pi = 0; pi < nchd; pi++)
+			len += this->chd_views[pi].size();
+		hdr[BP_SIZE] = len;
+
+		size_t base = out.size();
+		out.reserve(base + len);
+		out.insert(out.end(), hdr, hdr + BP_HEADER);
+		out.insert(out.end(), this->mapping, this->mapping + this->ncol);
+		size_t chd_pos = out.size();
+		out.resize(out.size() + nchd);
+		for (int i = 0; i < 2; i++)
+		{
+			vector<vector<pair<int, int>>> &area = 
+				(i == 0) ? this->unmarked_branches : this->marked_branches;
+			int count = 0;
+			for (int si = 0; si <= s; si++)
+			{
+				out.push_back(count);
+				if (si < s)
+					count += area[si].size();
+			}
+			for (int si = 0; si < s; si++)
+				for (pair<int, int> &e : area[si])
+				{
+					out.push_back(e.first);
+					out.push_back(e.second);
+				}
+		}
+		out.insert(out.end(), this->tree_choices.begin(), this->tree_choices.end());
+		out.insert(out.end(), this->tree_markers.begin(), this->tree_markers.end());
+		out.insert(out.end(), this->conflux_values.begin(), this->conflux_values.end());
+		out.insert(out.end(), this->psd_markers.begin(), this->psd_markers.end());
+		for (int pi = 0; pi < nchd; pi++)
+		{ // children are embedded as they are, their offsets are relative
+			out[chd_pos + pi] = out.size() - base;
+			const int *c = this->chd_views[pi].p;
+			out.insert(out.end(), c, c + this->chd_views[pi].size());
+		}
+	}
+
 	void printMapping()
 	{
 		cout << "(Mapping) (" << ncol+1 << ") [ ";
@@ -261,11 +466,19 @@ struct SIBranch
 		cout << "~~~Printing Branch~~~" << endl;
 		this->printMapping();
 		cout << "curr_u: " << curr_u << endl;
-		cout << "mapping_marker: " << mapping_marker << endl;
+		int W = query->marker_words;
+		cout << "mapping_marker: ";
+		marker_print(getMappingMarker(), W);
+		cout << endl;
 		cout << "tree_markers & conflux_values: " << endl;
-		for (int ti : tree_indices)
-			cout << "[ti=" << ti << "]: " << tree_markers[ti] << " | " 
-				 << conflux_values[ti] << endl;
+		for (int k = 0; k < tree_markers.size() / W; k++)
+		{
+			cout << "[k=" << k << "]: ";
+			marker_print(&tree_markers[k*W], W);
+			cout << " | ";
+			marker_print(&conflux_values[k*W], W);
+			cout << endl;
+		}
 
 		for (int i = 0; i < 2; i++)
 		{
@@ -293,10 +506,9 @@ struct SIBranch
 						cout << "(Psd Child) " << (*p)[si][ci].first << endl;
 					else if (chd_type == 0)
 					{
-						SIBranch *curr = chd_pointers[(*p)[si][ci].first];
 						cout << "(Child) " << ci << endl;
 						cout << "<Begin printing (Child) " << ci << ">" << endl;
-						curr->print();
+						chd_views[(*p)[si][ci].first].print();
 						cout << "<End printing (Child) " << ci << ">" << endl;
 					}
 				}
@@ -309,8 +521,11 @@ struct SIBranch
 		cout << "~~~Printing Branch~~~SIMPLE~~~" << endl;
 		this->printMapping();
 		cout << "curr_u: " << curr_u << endl;
-		cout << "mapping_marker: " << mapping_marker << endl;
-		cout << "tree_indices size: " << tree_indices.size() << endl;
+		int W = ((SIQuery*)getQuery())->marker_words;
+		cout << "mapping_marker: ";
+		marker_print(getMappingMarker(), W);
+		cout << endl;
+		cout << "#trees: " << tree_markers.size() / W << endl;
 
 		for (int i = 0; i < 2; i++)
 		{
@@ -335,48 +550,4 @@ struct SIBranch
 	}
 };
 
-ibinstream& operator<<(ibinstream& m, const SIBranch& branch)
-{
-    m << branch.ncol;
-	for (int i = 0; i < branch.ncol; i++)
-		m << branch.mapping[i];
-	m << branch.self << branch.curr_u << branch.T;
-
-	int sz = branch.chd_pointers.size();
-    m << sz;
-    for (int i = 0; i < sz; i++)
-    	m << (*branch.chd_pointers[i]);
-
-	m << branch.unmarked_branches << branch.marked_branches;
-
-	m << branch.tree_indices << branch.tree_markers << branch.conflux_values;
-    return m;
-}
-
-obinstream& operator>>(obinstream& m, SIBranch& branch)
-{
-	m >> branch.ncol;
-	branch.mapping = new int[branch.ncol];
-
-	for (int i = 0; i < branch.ncol; i++)
-		m >> branch.mapping[i];
-	m >> branch.self >> branch.curr_u >> branch.T;
-
-	int sz;
-    m >> sz;
-	branch.chd_pointers.resize(sz);
-    for (int i = 0; i < sz; i++)
-	{
-		SIBranch *b = new SIBranch();
-		m >> (*b);
-		branch.chd_pointers[i] = b;
-	}
-
-	m >> branch.unmarked_branches >> branch.marked_branches;
-
-	m >> branch.tree_indices >> branch.tree_markers >> branch.conflux_values;
-    return m;
-}
-
-
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,68 @@
+#ifndef SIMARKER_H
+#define SIMARKER_H
+
+//==========================================================================
+// Markers (conflict sets): bit ci of a marker is set iff conflict ci of the
+// query (see SIQuery::conflicts) is pending in a mapping or a tree.
+// A marker is W = SIQuery::marker_words consecutive ints, W being fixed when
+// the query is compiled (one word up to 32 conflicts). Markers are stored
+// inline, W ints per row, in the marker arrays of messages and branches.
+
+inline bool marker_empty(const int *m, int W)
+{
+	for (int i = 0; i < W; i++)
+		if (m[i] != 0)
+			return false;
+	return true;
+}
+
+inline bool marker_test(const int *m, int ci)
+{
+	return (m[ci >> 5] >> (ci & 31)) & 1;
+}
+
+inline void marker_set(int *m, int ci)
+{
+	m[ci >> 5] = (int)((unsigned)m[ci >> 5] | (1u << (ci & 31)));
+}
+
+// d = a | b, d may be a or b
+inline void marker_or(int *d, const int *a, const int *b, int W)
+{
+	for (int i = 0; i < W; i++)
+		d[i] = a[i] | b[i];
+}
+
+inline bool marker_equal(const int *a, const int *b, int W)
+{
+	for (int i = 0; i < W; i++)
+		if (a[i] != b[i])
+			return false;
+	return true;
+}
+
+inline bool marker_less(const int *a, const int *b, int W)
+{
+	for (int i = 0; i < W; i++)
+		if (a[i] != b[i])
+			return a[i] < b[i];
+	return false;
+}
+
+// appends the W words of m to out, zeros if m is NULL
+inline void marker_append(vector<int> &out, const int *m, int W)
+{
+	if (m == NULL)
+		out.insert(out.end(), W, 0);
+	else
+		out.insert(out.end(), m, m + W);
+}
+
+// prints the W words of m, word 0 first
+inline void marker_print(const int *m, int W)
+{
+	for (int i = 0; i < W; i++)
+		cout << (i == 0 ? "" : " ") << m[i];
+}
+
+#endif
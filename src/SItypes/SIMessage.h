@@ -19,10 +19,10 @@ struct SIMessage
 
 	int *mappings;
 	vector<int*> *passed_mappings;
-	vector<int> *markers;
+	vector<int> *markers; // W ints per row, see SIMarker.h
 	vector<int> *dummy_vs;
-	vector<int> chd_constraint;
-	SIBranch *branch;
+	vector<int> chd_constraint; // or the marker, for PSD_RESPONSE
+	vector<int> *packed; // BRANCH_RESULT, see BranchView
 
 	SIMessage()
 	{
@@ -61,17 +61,17 @@ struct SIMessage
 		this->chd_constraint = chd_constraint;
 	}
 
-	SIMessage(int type, SIBranch *branch)
+	SIMessage(int type, vector<int> *packed)
 	{ // for BRANCH_RESULT
 		this->type = type;
-		this->branch = branch;
+		this->packed = packed;
 	}
 
 	SIMessage(int type, int curr_u, int u_index,
 		int vID, int wID, int result_index, int state_i)
 	{ // for PSD_REQUEST or RESPONSE
 		this->type = type;
-		this->curr_u = curr_u;  // or conflict value
+		this->curr_u = curr_u;
 		this->u_index = u_index;
 		this->vID = vID;
 		this->wID = wID;
@@ -202,11 +202,14 @@ ibinstream & operator<<(ibinstream &m, const SIMessage &msg)
 		}
 		break;
 	case MESSAGE_TYPES::BRANCH_RESULT:
-		m << (*msg.branch);
+		m << (*msg.packed); // one memcpy
 		break;
 	case MESSAGE_TYPES::PSD_REQUEST:
+		m << msg.curr_u << msg.u_index << msg.vID << msg.wID << msg.nrow << msg.ncol;
+		break;
 	case MESSAGE_TYPES::PSD_RESPONSE:
 		m << msg.curr_u << msg.u_index << msg.vID << msg.wID << msg.nrow << msg.ncol;
+		m << msg.chd_constraint;
 		break;
 	}
 	return m;
@@ -218,7 +221,6 @@ obinstream & operator>>(obinstream &m, SIMessage &msg)
 	m >> msg.is_delete;
 	int sz;
 	int boo;		
-	SIBranch *b = new SIBranch();
 
 	switch (msg.type)
 	{
@@ -260,12 +262,15 @@ obinstream & operator>>(obinstream &m, SIMessage &msg)
 			m >> msg.mappings[i];
 		break;
 	case MESSAGE_TYPES::BRANCH_RESULT:
-		m >> (*b);
-		msg.branch = b;
+		msg.packed = new vector<int>();
+		m >> (*msg.packed);
 		break;
 	case MESSAGE_TYPES::PSD_REQUEST:
+		m >> msg.curr_u >> msg.u_index >> msg.vID >> msg.wID >> msg.nrow >> msg.ncol;
+		break;
 	case MESSAGE_TYPES::PSD_RESPONSE:
 		m >> msg.curr_u >> msg.u_index >> msg.vID >> msg.wID >> msg.nrow >> msg.ncol;
+		m >> msg.chd_constraint;
 		break;
 	}
 	return m;
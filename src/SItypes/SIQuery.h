@@ -1,6 +1,8 @@
 #ifndef SIQUERY_H
 #define SIQUERY_H
 
+#include "SItypes/SIMarker.h"
+
 //// Definitions ////
 
 // buckets
@@ -29,6 +31,41 @@ namespace __gnu_cxx {
 	};
 }
 
+//=============================================================================
+// read-only view of consecutive ints of a compiled table
+struct IntSpan
+{
+	const int *first;
+	int len;
+
+	IntSpan() : first(NULL), len(0) {}
+	IntSpan(const int *first, int len) : first(first), len(len) {}
+
+	const int *begin() const { return first; }
+	const int *end() const { return first + len; }
+	int size() const { return len; }
+	bool empty() const { return len == 0; }
+	int operator[](int i) const { return first[i]; }
+};
+
+// rows of ints stored back to back (CSR)
+struct FlatTable
+{
+	vector<int> offsets = {0};
+	vector<int> data;
+
+	void clear() { offsets.assign(1, 0); data.clear(); }
+
+	void addRow(const vector<int> &row)
+	{
+		data.insert(data.end(), row.begin(), row.end());
+		offsets.push_back(data.size());
+	}
+
+	IntSpan row(int i) const
+	{ return IntSpan(data.data() + offsets[i], offsets[i+1] - offsets[i]); }
+};
+
 //=============================================================================
 struct SINode
 {
@@ -83,7 +120,13 @@ struct SINode
 	// ONLY AVAILABLE FOR BRANCH OR LEAF VERTEX (blu):
 	// rci, related conflict indices
 	vector<int> rci;
-	int caoc_value = 0; // reflect how many conflicts it can solve
+	vector<int> caoc_indices; // the conflicts it can solve
+	// for symmetry breaking (see SIQuery::breakSymmetry):
+	// positions in previous_mapping that must hold a smaller (less) or
+	// a larger (greater) data vertex than this one
+	vector<int> sym_less_pos, sym_greater_pos;
+	// divisor of the multi_psd_chd count, in the same order as chd_types
+	vector<int> sym_div;
 
 	SINode() { this->visited = false; }
 
@@ -145,7 +188,7 @@ ostream & operator << (ostream & os, const vector<bool> & v)
 // Overloading << operator of SINode for debug purpose.
 ostream & operator << (ostream & os, const SINode & node)
 {
-	os << "[Label: " << (char) node.label 
+	os << "[Label: " << get_label_name(node.label)
 	   << " Neighbors: " << node.nbs
 	   << " Level: " << node.level
 	   << " Branch number: " << node.branch_number
@@ -222,10 +265,40 @@ public:
 	vector<vector<int>> bucket_size_key;
 	vector<vector<vector<int>>> bucket_size_value;
 	vector<int> bucket_number;
-
-	void init(const string &order, bool pseudo)
+	// dense label-indexed tables (label IDs are dense, see utils/tokenizer.h)
+	// bucket_index[level][label]: index in bucket_size_value[level] or -1
+	vector<vector<int>> bucket_index;
+	// label_nodes[label]: query vertices with this label
+	vector<vector<int>> label_nodes;
+
+	// compiled query (see compile()), read-only during the computation
+	int n_labels = 0;
+	FlatTable c_buckets; // row level * n_labels + label
+	FlatTable c_b_nbs_pos, c_b_same_lab_pos, c_chd_types, c_rci; // row: node
+	// row: node, one entry per child state, 1 if a conflict vertex is
+	// extracted through the marked branches of that state (see
+	// SIBranch::enumerateTrees, only the other states are grouped)
+	FlatTable c_chd_extract;
+	// row: node, the marker of the conflicts it solves (caoc)
+	FlatTable c_caoc;
+	vector<int> c_conflict_index; // [id * num + mapped_u]: conflict or -1
+	int marker_words = 1; // W, see SItypes/SIMarker.h
+	FlatTable c_sym_less, c_sym_greater, c_sym_div; // row: node
+	// row: node, one entry per child state, 1 if the pseudo child is
+	// folded: its unmarked branches are one (count, 0) pair (-leaf)
+	FlatTable c_chd_folded;
+	bool fold_leaves = false;
+
+	// symmetry breaking: |Aut| of the query, and the product of the orbit
+	// sizes broken by the ordering constraints (embeddings = count * it)
+	long aut_size = 1;
+	long sym_factor = 1;
+
+	void init(const string &order, bool pseudo, bool symmetry = false,
+		bool leaf = false)
 	{ // call after the query is sent to each worker
 		this->num = this->nodes.size();
+		this->fold_leaves = leaf;
 		this->nbancestors.resize(this->num);
 
 		// order = "degree", value = degree
@@ -274,26 +347,105 @@ public:
 			sequence.clear();
 			this->addPrevMapping(this->root, sequence, -1);
 			this->addConflicts();
+			if (symmetry)
+				this->breakSymmetry();
+			this->compile();
 		}
 	}
 
-	virtual void addNode(char* line)
+	// flatten the per-node metadata used by compute/enumerate into
+	// contiguous tables, the accessors below return spans of them
+	void compile()
 	{
-		char * pch;
-		pch = strtok(line, " \t");
-		int id = atoi(pch);
+		c_buckets.clear();
+		for (int level = 0; level <= this->max_level; ++level)
+			for (int label = 0; label < this->n_labels; ++label)
+			{
+				int b = this->bucket_index[level][label];
+				c_buckets.addRow(b < 0 ? vector<int>() :
+					this->bucket_size_value[level][b]);
+			}
 
-		pch = strtok(NULL, " \t");
-		int label = (int) *pch;
+		c_b_nbs_pos.clear();
+		c_b_same_lab_pos.clear();
+		c_chd_types.clear();
+		c_rci.clear();
+		c_chd_extract.clear();
+		c_caoc.clear();
+		c_sym_less.clear();
+		c_sym_greater.clear();
+		c_sym_div.clear();
+		c_chd_folded.clear();
+		c_conflict_index.assign(this->num * this->num, -1);
+		this->marker_words = max(1, ((int)this->conflicts.size() + 31) / 32);
+		for (int id = 0; id < this->num; ++id)
+		{
+			SINode &node = this->nodes[id];
+			c_b_nbs_pos.addRow(node.b_nbs_pos);
+			c_b_same_lab_pos.addRow(node.b_same_lab_pos);
+			c_chd_types.addRow(node.chd_types);
+			c_rci.addRow(node.rci);
+			// the first entry of a mapped_u wins, as in the linear scan
+			for (int i = node.conflict_index_key.size() - 1; i >= 0; --i)
+				c_conflict_index[id * this->num + node.conflict_index_key[i]] =
+					node.conflict_index_value[i];
+			vector<int> caoc = vector<int>(this->marker_words, 0);
+			for (int ci : node.caoc_indices)
+				marker_set(&caoc[0], ci);
+			c_caoc.addRow(caoc);
+			c_sym_less.addRow(node.sym_less_pos);
+			c_sym_greater.addRow(node.sym_greater_pos);
+			vector<int> div = node.sym_div;
+			div.resize(node.chd_types.size(), 1);
+			c_sym_div.addRow(div);
+			// leaf folding: a pseudo child without conflicts is only
+			// counted (uniqueness and symmetry are checked on the count)
+			vector<int> folded = vector<int>(node.chd_types.size(), 0);
+			for (int i = 0; i < node.ps_children.size(); i++)
+				if (this->fold_leaves && !hasConflict(node.ps_children[i]))
+					folded[node.children.size() + i] = 1;
+			c_chd_folded.addRow(folded);
+		}
+
+		// follow index_chain_2 of every conflict from its common ancestor,
+		// as SIBranch::extractConflictVertex does
+		vector<vector<int>> extract(this->num);
+		for (int id = 0; id < this->num; ++id)
+			extract[id].assign(this->nodes[id].chd_types.size(), 0);
+		for (const Conflict &c : this->conflicts)
+		{
+			const vector<int> &chain = c.index_chain_2;
+			int u = c.common_ancestor;
+			for (int ind = 0; ind + 1 < chain.size(); ind++)
+			{
+				extract[u][chain[ind]] = 1;
+				if (chain[ind+1] == -1)
+					break;
+				u = moveToBOL(getChildren(u)[chain[ind]]);
+			}
+		}
+		for (int id = 0; id < this->num; ++id)
+			c_chd_extract.addRow(extract[id]);
+	}
+
+	virtual void addNode(char* line)
+	{
+		// same format as the data graph, see SIWorker::toVertex
+		char * pch = skip_blanks(line);
+		if (*pch == '\0') return;
+		int id, label;
+		pch = parse_int(pch, id);
+		pch = parse_label(skip_blanks(pch), label);
 
 		int i1 = this->nodes.size();
 		this->nodes.push_back(SINode(id, label));
 		this->id_ind[id] = i1;
 
-		while ((pch = strtok(NULL, " ")) != NULL)
+		while (*(pch = skip_blanks(pch)) != '\0')
 		{
-			int neighbor = atoi(pch);
-			pch = strtok(NULL, " ");
+			int neighbor;
+			pch = parse_int(pch, neighbor);
+			pch = token_end(skip_blanks(pch)); // label of the neighbor
 			if (this->id_ind.find(neighbor) != this->id_ind.end())
 			{
 				int i2 = this->id_ind[neighbor];
@@ -323,7 +475,7 @@ public:
 		{
 			cout << "level " << i << endl;
 			for (int j = 0; j < this->bucket_size_value[i].size(); j++)
-				cout << "[key] " << (char) this->bucket_size_key[i][j]
+				cout << "[key] " << get_label_name(this->bucket_size_key[i][j])
 				     << " [value] " << this->bucket_size_value[i][j] << endl;
 		}
 		cout << this->bucket_number << endl;
@@ -611,7 +763,7 @@ public:
 		this->nodes[u2].conflict_index_value.push_back(index);
 
 		this->nodes[caoc].rci.push_back(index);
-		this->nodes[caoc].caoc_value += 1 << index;
+		this->nodes[caoc].caoc_indices.push_back(index);
 		this->nodes[u1_state].rci.push_back(index);
 	}
 
@@ -701,6 +853,196 @@ public:
 		}
 	}
 
+	//=====================================================================
+	// Symmetry breaking. The automorphisms of the query are walked along a
+	// stabilizer chain: O_i is the orbit of v_i under the automorphisms
+	// fixing v_1, ..., v_{i-1}. Requiring f(v_i) < f(w) for all w in O_i
+	// keeps exactly one embedding out of |O_i|, whichever other levels are
+	// required, so only the levels that are checked during the matching
+	// are enforced: w an ancestor of v_i or the converse, found in the
+	// previous_mapping of the descendant, or O_i within a multi_psd_chd
+	// without conflicts, whose count is then divided by |O_i|.
+
+	bool matchesAutomorphism(vector<int> &perm, int i, int u, int x)
+	{ // can u be mapped to x, given the images of dfs_order[0..i)
+		if (getLabel(x) != getLabel(u) || getNbs(x).size() != getNbs(u).size())
+			return false;
+		for (int j = 0; j < i; j++)
+		{
+			int y = this->dfs_order[j];
+			if (hasEdge(u, y) != hasEdge(x, perm[y]))
+				return false;
+		}
+		return true;
+	}
+
+	bool extendAutomorphism(vector<int> &perm, vector<bool> &used, int i)
+	{ // backtracking in dfs order, perm[u] = -1 if u is not mapped yet
+		if (i == this->dfs_order.size())
+			return true;
+		int u = this->dfs_order[i];
+		if (perm[u] >= 0) // prescribed
+			return matchesAutomorphism(perm, i, u, perm[u]) &&
+				extendAutomorphism(perm, used, i+1);
+		for (int x = 0; x < this->num; x++)
+		{
+			if (used[x] || !matchesAutomorphism(perm, i, u, x))
+				continue;
+			perm[u] = x;
+			used[x] = true;
+			if (extendAutomorphism(perm, used, i+1))
+				return true;
+			perm[u] = -1;
+			used[x] = false;
+		}
+		return false;
+	}
+
+	bool isAutomorphic(const vector<int> &fixed, int u, int w)
+	{ // some automorphism fixing all of fixed maps u to w
+		vector<int> perm = vector<int>(this->num, -1);
+		vector<bool> used = vector<bool>(this->num, false);
+		for (int f : fixed)
+		{
+			perm[f] = f;
+			used[f] = true;
+		}
+		perm[u] = w;
+		used[w] = true;
+		return extendAutomorphism(perm, used, 0);
+	}
+
+	int getPsdState(int id)
+	{ // index of the pseudo child id in chd_types of its parent
+		SINode &p = this->nodes[getParent(id)];
+		int k = 0;
+		while (p.ps_children[k] != id) k++;
+		return p.children.size() + k;
+	}
+
+	int getSymPos(int id, int anc)
+	{ // position of anc in previous_mapping of id, -1 if not checked there
+		int limit = this->nodes[id].previous_mapping.size();
+		if (isPseudo(id))
+		{ // checked by the parent, on its own mapping
+			if (this->nodes[getParent(id)].chd_types[getPsdState(id)] != 1)
+				return -1; // multi_psd_chd
+			limit = getNCOL(getParent(id));
+		}
+		for (int pos = 0; pos < limit; pos++)
+			if (this->nodes[id].previous_mapping[pos] == anc)
+				return pos;
+		return -1;
+	}
+
+	bool isPsdGroup(int u, int w)
+	{ // u and w belong to the same multi_psd_chd, free of conflicts
+		if (!isPseudo(u) || !isPseudo(w) || getParent(u) != getParent(w) ||
+			getLabel(u) != getLabel(w))
+			return false;
+		for (int sib : getPseudoChildren(getParent(u)))
+			if (getLabel(sib) == getLabel(u) && hasConflict(sib))
+				return false;
+		return true;
+	}
+
+	bool canBreak(int v, const vector<int> &orbit)
+	{
+		for (int w : orbit)
+		{
+			if (w == v) continue;
+			if (isAncestor(w, v))
+			{
+				if (getSymPos(v, w) < 0) return false;
+			}
+			else if (isAncestor(v, w))
+			{
+				if (getSymPos(w, v) < 0) return false;
+			}
+			else if (!isPsdGroup(v, w))
+				return false;
+		}
+		return true;
+	}
+
+	void addSymConstraints(int v, const vector<int> &orbit)
+	{ // f(v) < f(w) for all w in orbit
+		bool grouped = false;
+		for (int w : orbit)
+		{
+			if (w == v) continue;
+			if (isAncestor(w, v))
+				this->nodes[v].sym_greater_pos.push_back(getSymPos(v, w));
+			else if (isAncestor(v, w))
+				this->nodes[w].sym_less_pos.push_back(getSymPos(w, v));
+			else
+				grouped = true;
+		}
+		if (grouped)
+		{ // the count is kept by the first pseudo child of the label
+			SINode &p = this->nodes[getParent(v)];
+			int k = 0;
+			while (getLabel(p.ps_children[k]) != getLabel(v)) k++;
+			p.sym_div[p.children.size() + k] *= orbit.size();
+		}
+	}
+
+	void breakSymmetry()
+	{
+		for (int id = 0; id < this->num; ++id)
+			this->nodes[id].sym_div.assign(this->nodes[id].chd_types.size(), 1);
+		this->aut_size = 1;
+		this->sym_factor = 1;
+		vector<int> fixed;
+		vector<bool> is_fixed = vector<bool>(this->num, false);
+		while (true)
+		{
+			// orbits of the stabilizer of fixed, in dfs order: take the
+			// first one that can be broken, else the first nontrivial one
+			vector<bool> seen = is_fixed;
+			vector<int> orbit;
+			int v = -1;
+			bool breakable = false;
+			for (int u : this->dfs_order)
+			{
+				if (seen[u]) continue;
+				vector<int> o = {u};
+				seen[u] = true;
+				for (int w = 0; w < this->num; ++w)
+					if (!seen[w] && isAutomorphic(fixed, u, w))
+					{
+						o.push_back(w);
+						seen[w] = true;
+					}
+				if (o.size() == 1) continue;
+				if (v < 0)
+				{
+					v = u;
+					orbit = o;
+				}
+				for (int r : o)
+					if (canBreak(r, o))
+					{
+						v = r;
+						orbit = o;
+						breakable = true;
+						break;
+					}
+				if (breakable) break;
+			}
+			if (v < 0) break; // only the identity is left
+
+			this->aut_size *= orbit.size();
+			if (breakable)
+			{
+				this->sym_factor *= orbit.size();
+				this->addSymConstraints(v, orbit);
+			}
+			fixed.push_back(v);
+			is_fixed[v] = true;
+		}
+	}
+
 	// Query is read-only.
 	// get functions before dfs.
 	int getID(int id) { return this->nodes[id].id; }
@@ -723,16 +1065,14 @@ public:
 	// fill cand_map with right vertices
 	void LDFFilter(int label, size_t degree, hash_map<int, vector<int> > &cand_map)
 	{
-		vector<int> nbs;
-		int curr_u, lab;
-		for (curr_u = 0; curr_u < this->nodes.size(); ++curr_u)
+		if (label >= this->label_nodes.size())
+			return;
+		vector<int> &us = this->label_nodes[label];
+		for (size_t i = 0; i < us.size(); ++i)
 		{
-			lab = this->nodes[curr_u].label;
-			nbs = this->nodes[curr_u].nbs;
-			if (lab == label && nbs.size() <= degree)
-			{
-				cand_map[curr_u] = nbs;
-			}
+			vector<int> &nbs = this->nodes[us[i]].nbs;
+			if (nbs.size() <= degree)
+				cand_map[us[i]] = nbs;
 		}
 	}
 
@@ -746,12 +1086,22 @@ public:
 	{ return this->nodes[id].children; }
 	vector<int> &getPseudoChildren(int id)
 	{ return this->nodes[id].ps_children; }	
-	vector<int> &getChdTypes(int id)
-	{ return this->nodes[id].chd_types; }
-	vector<int> &getBNeighborsPos(int id)
-	{ return this->nodes[id].b_nbs_pos; }
-	vector<int> &getBSameLabPos(int id)
-	{ return this->nodes[id].b_same_lab_pos; }
+	IntSpan getChdTypes(int id)
+	{ return this->c_chd_types.row(id); }
+	IntSpan getChdExtract(int id)
+	{ return this->c_chd_extract.row(id); }
+	IntSpan getChdFolded(int id)
+	{ return this->c_chd_folded.row(id); }
+	IntSpan getBNeighborsPos(int id)
+	{ return this->c_b_nbs_pos.row(id); }
+	IntSpan getBSameLabPos(int id)
+	{ return this->c_b_same_lab_pos.row(id); }
+	IntSpan getSymLessPos(int id)
+	{ return this->c_sym_less.row(id); }
+	IntSpan getSymGreaterPos(int id)
+	{ return this->c_sym_greater.row(id); }
+	IntSpan getSymDivisors(int id)
+	{ return this->c_sym_div.row(id); }
 	vector<int> &getPrevMapping(int id)
 	{ return this->nodes[id].previous_mapping; }
 	vector<int> &getBranchSenders(int id)
@@ -768,26 +1118,18 @@ public:
 	{ return this->nodes[id].dummy_pos; }
 	int getNearestBranchingAncestor(int id)
 	{ return this->nbancestors[id]; }
-	vector<Conflict> getConflicts()
+	const vector<Conflict> &getConflicts()
 	{ return this->conflicts; }
-	Conflict getConflict(int ci)
+	const Conflict &getConflict(int ci)
 	{ return this->conflicts[ci]; }
-	int getConflictNumber(int id, int mapped_u)
-	{
-		int i = 0;
-		for (; i < this->nodes[id].conflict_index_key.size()
-		&& this->nodes[id].conflict_index_key[i] != mapped_u; i++);
-		if (i < this->nodes[id].conflict_index_value.size())
-			return (1 << this->nodes[id].conflict_index_value[i]);
-		else // not matched
-			return 0;
-	}
-	int getCAOCValue(int id)
-	{ return this->nodes[id].caoc_value; }
-	vector<int> getIndexChain(int id)
+	int getConflictIndex(int id, int mapped_u)
+	{ return this->c_conflict_index[id * this->num + mapped_u]; }
+	const int *getCAOCValue(int id)
+	{ return this->c_caoc.row(id).begin(); }
+	const vector<int> &getIndexChain(int id)
 	{ return this->nodes[id].index_chain; }
-	vector<int> getRelatedConflictIndices(int id) // only for blu
-	{ return this->nodes[id].rci; }
+	IntSpan getRelatedConflictIndices(int id) // only for blu
+	{ return this->c_rci.row(id); }
 	bool isCAOC(int id)
 	{
 		for (int i = 0; i < this->conflicts.size(); i++)
@@ -820,35 +1162,38 @@ public:
 		this->bucket_size_value.resize(this->max_level+1);
 		this->bucket_number.resize(this->nodes.size());
 
+		this->n_labels = 0;
+		for (int i = 0; i < this->nodes.size(); ++i)
+			this->n_labels = max(this->n_labels, this->nodes[i].label + 1);
+		this->bucket_index.assign(this->max_level+1, vector<int>(this->n_labels, -1));
+		this->label_nodes.assign(this->n_labels, vector<int>());
+
 		SINode *curr;
 		for (int i = 0; i < this->nodes.size(); ++i)
 		{
-			bool flag = true;
 			curr = &this->nodes[i];
+			this->label_nodes[curr->label].push_back(i);
 			vector<int> &keys = this->bucket_size_key[curr->level];
 			vector<vector<int>> &vals = this->bucket_size_value[curr->level];
-			for (int j = 0; j < keys.size(); ++j)
+			int &b = this->bucket_index[curr->level][curr->label];
+			if (b >= 0)
 			{
-				if (keys[j] == curr->label)
-				{
-					if (curr->is_pseudo)
-					{ // insert at the front
-						for (int val : vals[j])
-							this->bucket_number[val] ++;
-						vals[j].insert(vals[j].begin(), i);
-						this->bucket_number[i] = 0;
-					}
-					else
-					{ // push at the back
-						this->bucket_number[i] = vals[j].size();
-						vals[j].push_back(i);
-					}
-					flag = false;
-					break;
+				if (curr->is_pseudo)
+				{ // insert at the front
+					for (int val : vals[b])
+						this->bucket_number[val] ++;
+					vals[b].insert(vals[b].begin(), i);
+					this->bucket_number[i] = 0;
+				}
+				else
+				{ // push at the back
+					this->bucket_number[i] = vals[b].size();
+					vals[b].push_back(i);
 				}
 			}
-			if (flag)
+			else
 			{
+				b = keys.size();
 				keys.push_back(curr->label);
 				vector<int> v_i = {i};
 				vals.push_back(v_i);
@@ -891,19 +1236,11 @@ public:
 	}
 
 	// get functions regarding buckets
-	vector<int> getBucket(int level, int label)
+	IntSpan getBucket(int level, int label)
 	{
-		if (level >= this->bucket_size_key.size())
-			return vector<int>();
-			
-		vector<int> &k = this->bucket_size_key[level];
-		size_t sz = k.size();
-		for (size_t j = 0; j < sz; ++j)
-		{
-			if (k[j] == label) 
-				return this->bucket_size_value[level][j];
-		}
-		return vector<int>();
+		if (level > this->max_level || label >= this->n_labels)
+			return IntSpan();
+		return this->c_buckets.row(level * this->n_labels + label);
 	}
 
 	int getBucketNumber(int id)
@@ -39,6 +39,38 @@ struct SIValue
 	{
 		return nbs_set.find(vID) != nbs_set.end();
 	}
+
+	// group nbs_vector by label, called once the label IDs are final
+	void sortNeighbors()
+	{
+		sort(nbs_vector.begin(), nbs_vector.end(),
+			[](const KeyLabel &a, const KeyLabel &b)
+			{ return a.label < b.label ||
+				(a.label == b.label && a.key.vID < b.key.vID); });
+	}
+
+	// [first, second) of the neighbors with the given label
+	inline pair<int, int> labelRange(int lab)
+	{
+		auto lo = lower_bound(nbs_vector.begin(), nbs_vector.end(), lab,
+			[](const KeyLabel &kl, int l) { return kl.label < l; });
+		auto hi = upper_bound(lo, nbs_vector.end(), lab,
+			[](int l, const KeyLabel &kl) { return l < kl.label; });
+		return make_pair(lo - nbs_vector.begin(), hi - nbs_vector.begin());
+	}
+
+	// the same, restricted to the neighbors with lo < vID < hi
+	inline pair<int, int> labelRange(int lab, int lo, int hi)
+	{
+		pair<int, int> r = labelRange(lab);
+		auto first = nbs_vector.begin() + r.first;
+		auto last = nbs_vector.begin() + r.second;
+		auto b = upper_bound(first, last, lo,
+			[](int v, const KeyLabel &kl) { return v < kl.key.vID; });
+		auto e = lower_bound(b, last, hi,
+			[](const KeyLabel &kl, int v) { return kl.key.vID < v; });
+		return make_pair(b - nbs_vector.begin(), e - nbs_vector.begin());
+	}
 };
 
 ibinstream & operator<<(ibinstream & m, const SIValue & v){
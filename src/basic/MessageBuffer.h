@@ -8,6 +8,13 @@
 #include "../utils/vecs.h"
 using namespace std;
 
+//thread-local send buffers of a parallel superstep (VecGroup*, vector<VertexT*>*),
+//see Worker::parallel_compute; NULL in sequential code, where out_messages and
+//to_add are used. Untyped like get_message_buffer(), since vertices see the
+//buffer as MessageBuffer<base Vertex>
+thread_local void* _local_out = NULL;
+thread_local void* _local_add = NULL;
+
 template <class VertexT>
 class MessageBuffer {
 public:
@@ -50,6 +57,34 @@ public:
         out_messages.append(id, msg);
     }
 
+    void add_message_by_wID(const int wID, const vector<int>& keys, const MessageT& msg)
+    {
+        if (_local_out != NULL) {
+            (*(VecGroup*)_local_out)[wID].push_back(msgpair<MessageT>(keys, msg));
+            return;
+        }
+        hasMsg(); //cannot end yet even every vertex halts
+        out_messages.append_by_wID(wID, keys, msg);
+    }
+
+    //appends the thread-local buffers to out_messages and to_add
+    void merge_local(vector<VecGroup>& outs, vector<vector<VertexT*> >& adds)
+    {
+        for (size_t t = 0; t < outs.size(); t++) {
+            for (size_t wID = 0; wID < outs[t].size(); wID++) {
+                Vec& from = outs[t][wID];
+                if (from.empty())
+                    continue;
+                hasMsg();
+                Vec& to = out_messages.getBuf(wID);
+                to.insert(to.end(), make_move_iterator(from.begin()), make_move_iterator(from.end()));
+            }
+            if (!adds[t].empty())
+                hasMsg();
+            to_add.insert(to_add.end(), adds[t].begin(), adds[t].end());
+        }
+    }
+
     Map& get_messages()
     {
         return in_messages;
@@ -138,6 +173,10 @@ public:
 
     void add_vertex(VertexT* v)
     {
+        if (_local_add != NULL) {
+            ((vector<VertexT*>*)_local_add)->push_back(v);
+            return;
+        }
         hasMsg(); //cannot end yet even every vertex halts
         to_add.push_back(v);
     }
@@ -101,8 +101,7 @@ public:
     // newly added function
     void send_messages(const int& wID, const vector<int>& keys, const MessageT& msg)
     {
-        hasMsg();
-        ((MessageBufT*)get_message_buffer())->out_messages.append_by_wID(wID, keys, msg);
+        ((MessageBufT*)get_message_buffer())->add_message_by_wID(wID, keys, msg);
     }
 
     void add_vertex(VertexT* v)
@@ -2,11 +2,17 @@
 #define WORKER_H
 
 #include <vector>
+#include <fstream>
+#include <thread>
 #include "../utils/global.h"
 #include "MessageBuffer.h"
 #include <string>
 #include "../utils/communication.h"
+#ifndef NO_HDFS
 #include "../utils/ydhdfs.h"
+#endif
+#include "../utils/localfs.h"
+#include "../utils/scheduler.h"
 #include "../utils/Combiner.h"
 #include "../utils/Aggregator.h"
 #include "../utils/Query.h"
@@ -25,10 +31,14 @@ class Worker {
     typedef typename MessageBufT::MessageContainerT MessageContainerT;
     typedef typename MessageBufT::Map Map;
     typedef typename MessageBufT::MapIter MapIter;
+    typedef typename MessageBufT::VecGroup VecGroup;
 
     typedef typename AggregatorT::PartialType PartialT;
     typedef typename AggregatorT::FinalType FinalT;
 
+    typedef hash_map<int, VertexT*> GhostMap; //vID -> read-only replica
+    typedef typename GhostMap::iterator GhostIter;
+
 public:
     Worker()
     {
@@ -41,6 +51,7 @@ public:
         aggregator = NULL;
         global_aggregator = NULL;
         global_agg = NULL;
+        scheduler = NULL;
     }
 
     void setCombiner(Combiner<MessageT>* cb)
@@ -65,10 +76,15 @@ public:
     {
         for (size_t i = 0; i < vertexes.size(); i++)
             delete vertexes[i];
+        for (GhostIter it = ghosts.begin(); it != ghosts.end(); it++)
+            delete it->second;
+        global_ghosts = NULL;
         delete message_buffer;
+        delete scheduler;
         if (getAgg() != NULL)
             delete (FinalT*)global_agg;
         //worker_finalize();//put to run.cpp
+        shm_free();
         worker_barrier(); //newly added for ease of multi-job programming in run.cpp
     }
 
@@ -102,8 +118,265 @@ public:
         //PrintTimer("Reduce Time",4);
     };
 
+    //user-defined ghost selector ==========================
+    //returns true if v should be mirrored on every worker
+    virtual bool to_ghost(VertexT* v)
+    {
+        return false;
+    }
+
+    //replicate the selected (hub) vertices on all other workers,
+    //call after PREPROCESS so that local vertices are ready.
+    //returns the number of local vertices mirrored by this worker
+    int sync_ghosts(WorkerParams params)
+    {
+        if (get_ghost_threshold() <= 0)
+            return 0;
+
+        int hub_count = 0;
+        vector<VertexContainer> to_mirror(_num_workers);
+        for (size_t i = 0; i < vertexes.size(); i++) {
+            VertexT* v = vertexes[i];
+            if (!to_ghost(v))
+                continue;
+            hub_count++;
+            for (int wID = 0; wID < _num_workers; wID++)
+                if (wID != _my_rank)
+                    to_mirror[wID].push_back(v);
+        }
+        //received replicas replace the sent pointers (still owned by vertexes)
+        all_to_all(to_mirror);
+
+        vector<MessageT> no_msgs;
+        for (int wID = 0; wID < _num_workers; wID++) {
+            if (wID == _my_rank)
+                continue;
+            for (size_t i = 0; i < to_mirror[wID].size(); i++) {
+                VertexT* g = to_mirror[wID][i];
+                g->preprocess(no_msgs, params); //rebuild non-serialized fields
+                ghosts[g->id.vID] = g;
+            }
+        }
+        global_ghosts = &ghosts;
+        return hub_count;
+    }
+
+    //user-defined load balancing hooks ====================
+    //load of v in this superstep, in units that can be shipped in ranges
+    virtual long long vertex_load(VertexT* v, MessageContainerT& msgs)
+    {
+        return msgs.size();
+    }
+
+    //on the owner of v: packs the load units [first, last) of v into share
+    virtual void pack_share(VertexT* v, MessageContainerT& msgs,
+        long long first, long long last, vector<int>& share) {}
+
+    //on the helper: computes a share, the result is routed back to the owner
+    virtual void run_share(vector<int>& share, vector<int>& result) {}
+
+    //on the owner of v: takes the result of the units [first, last) of v,
+    //before v is computed as usual
+    virtual void unpack_share(VertexT* v, MessageContainerT& msgs,
+        long long first, long long last, vector<int>& result) {}
+
+    //skew mitigation before active_compute, collective (params.balance > 0):
+    //every worker reports its load and its heaviest vertices to MASTER, who
+    //plans moves of load ranges (taken from the end of a heavy vertex) from
+    //workers above the average to those below it, as long as some worker is
+    //over params.balance times the average; the owners ship the shares, the
+    //helpers run them and send the results back, for this superstep only.
+    //Returns the number of units moved away from this worker
+    long long balance_load(const WorkerParams& params)
+    {
+        MessageBufT* mbuf = (MessageBufT*)get_message_buffer();
+        vector<MessageContainerT>& v_msgbufs = mbuf->get_v_msg_bufs();
+
+        //report: total load, then (index, load) of the heaviest vertices
+        vector<pair<long long, int> > heavy;
+        long long total = 0;
+        for (size_t i = 0; i < vertexes.size(); i++) {
+            if (v_msgbufs[i].empty())
+                continue;
+            long long load = vertex_load(vertexes[i], v_msgbufs[i]);
+            total += load;
+            if (load >= BALANCE_MIN_SHARE)
+                heavy.push_back(make_pair(load, (int)i));
+        }
+        int k = min((int)heavy.size(), BALANCE_TOP_K);
+        partial_sort(heavy.begin(), heavy.begin() + k, heavy.end(), greater<pair<long long, int> >());
+        vector<long long> report(1, total);
+        for (int j = 0; j < k; j++) {
+            report.push_back(heavy[j].second);
+            report.push_back(heavy[j].first);
+        }
+
+        //plan: moves[r] = (index, first, last, helper) * #moves of worker r
+        vector<long long> my_moves;
+        if (_my_rank == MASTER_RANK) {
+            vector<vector<long long> > reports(_num_workers);
+            masterGather(reports);
+            reports[MASTER_RANK] = report;
+            vector<long long> loads(_num_workers);
+            long long sum = 0, max_load = 0;
+            for (int r = 0; r < _num_workers; r++) {
+                loads[r] = reports[r][0];
+                sum += loads[r];
+                max_load = max(max_load, loads[r]);
+            }
+            long long avg = sum / _num_workers;
+            vector<vector<long long> > moves(_num_workers);
+            if (max_load > params.balance * avg) {
+                for (int r = 0; r < _num_workers; r++) {
+                    vector<long long>& rep = reports[r];
+                    for (size_t j = 1; j + 1 < rep.size() && loads[r] > avg; j += 2) {
+                        long long last = rep[j + 1]; //units are taken from the end
+                        while (loads[r] > avg) {
+                            int h = min_element(loads.begin(), loads.end()) - loads.begin();
+                            long long amount = min(min(loads[r] - avg, avg - loads[h]), last);
+                            if (amount < BALANCE_MIN_SHARE)
+                                break;
+                            moves[r].push_back(rep[j]);
+                            moves[r].push_back(last - amount);
+                            moves[r].push_back(last);
+                            moves[r].push_back(h);
+                            last -= amount;
+                            loads[r] -= amount;
+                            loads[h] += amount;
+                        }
+                    }
+                }
+            }
+            masterScatter(moves);
+            my_moves.swap(moves[MASTER_RANK]);
+        } else {
+            slaveGather(report);
+            slaveScatter(my_moves);
+        }
+
+        //ship the shares, run the received ones, route the results back
+        vector<vector<vector<int> > > shares(_num_workers), received(_num_workers);
+        long long moved = 0;
+        for (size_t j = 0; j < my_moves.size(); j += 4) {
+            int i = my_moves[j], h = my_moves[j + 3];
+            shares[h].push_back(vector<int>());
+            pack_share(vertexes[i], v_msgbufs[i], my_moves[j + 1], my_moves[j + 2], shares[h].back());
+            moved += my_moves[j + 2] - my_moves[j + 1];
+        }
+        all_to_all(shares, received);
+        vector<vector<vector<int> > > results(_num_workers), returned(_num_workers);
+        for (int r = 0; r < _num_workers; r++) {
+            results[r].resize(received[r].size());
+            for (size_t j = 0; j < received[r].size(); j++)
+                run_share(received[r][j], results[r][j]);
+        }
+        all_to_all(results, returned);
+        vector<int> next(_num_workers, 0);
+        for (size_t j = 0; j < my_moves.size(); j += 4) {
+            int i = my_moves[j], h = my_moves[j + 3];
+            unpack_share(vertexes[i], v_msgbufs[i], my_moves[j + 1], my_moves[j + 2], returned[h][next[h]++]);
+        }
+        return moved;
+    }
+
+    //one vertex of active_compute
+    inline void compute_vertex(int type, VertexT* v, MessageContainerT& msgs, WorkerParams& params)
+    {
+        switch (type)
+        {
+        case PREPROCESS:
+            v->preprocess(msgs, params);
+            break;
+        case FILTER:
+            v->filter(msgs);
+            break;
+        case MATCH:
+            v->compute(msgs, params);
+            break;
+        case ENUMERATE:
+            v->enumerate(msgs);
+            break;
+        }
+        //clear used msgs
+        msgs.clear();
+    }
+
+    //active_compute on params.threads threads, for PREPROCESS and MATCH:
+    //the vertices to compute are cut into tasks of about the same number of
+    //messages (a hub gets a task of its own), dealt in contiguous blocks to
+    //the deques of the threads and rebalanced by work stealing; inside a
+    //task, compute() may fork row-range subtasks with parallel_for().
+    //Messages and vertices sent by a task go to the send buffers of its
+    //thread, appended to the message buffer at the end. The threads are
+    //those of scheduler, started at the first call
+    int parallel_compute(int type, WorkerParams& params, int wakeAll)
+    {
+        MessageBufT* mbuf = (MessageBufT*)get_message_buffer();
+        vector<MessageContainerT>& v_msgbufs = mbuf->get_v_msg_bufs();
+        int n = params.threads;
+
+        vector<int> todo;
+        long long work = 0;
+        for (size_t i = 0; i < vertexes.size(); i++) {
+            if (wakeAll == 1)
+                vertexes[i]->activate();
+            if (vertexes[i]->is_active() || v_msgbufs[i].size() != 0) {
+                todo.push_back(i);
+                work += v_msgbufs[i].size() + 1;
+            }
+        }
+
+        if (scheduler == NULL || scheduler->num_threads() != n) {
+            delete scheduler;
+            scheduler = new TaskScheduler(n);
+        }
+        TaskScheduler& sched = *scheduler;
+        atomic<int> active(0);
+        long long grain = max(1LL, work / ((long long)n * TASKS_PER_THREAD));
+        vector<pair<int, int> > ranges; //[first, last) of todo
+        for (size_t first = 0, last; first < todo.size(); first = last) {
+            long long w = 0;
+            for (last = first; last < todo.size() && w < grain; last++) {
+                long long vw = v_msgbufs[todo[last]].size() + 1;
+                if (vw >= grain && last > first)
+                    break; //a hub starts a task of its own
+                w += vw;
+            }
+            ranges.push_back(make_pair(first, last));
+        }
+        for (size_t r = 0; r < ranges.size(); r++) {
+            int first = ranges[r].first, last = ranges[r].second;
+            sched.spawn(r * n / ranges.size(), Task([&, first, last]() {
+                int n_active = 0;
+                for (int j = first; j < last; j++) {
+                    int i = todo[j];
+                    compute_vertex(type, vertexes[i], v_msgbufs[i], params);
+                    if (vertexes[i]->is_active())
+                        n_active++;
+                }
+                active += n_active;
+            }, NULL));
+        }
+
+        vector<VecGroup> outs(n, VecGroup(_num_workers));
+        vector<VertexContainer> adds(n);
+        sched.run([&](int t) {
+            _local_out = &outs[t];
+            _local_add = &adds[t];
+        });
+        _local_out = NULL;
+        _local_add = NULL;
+        mbuf->merge_local(outs, adds);
+
+        active_count = active;
+        return todo.size();
+    }
+
     int active_compute(int type, WorkerParams params, int wakeAll)
     {
+        if (params.threads > 1 && (type == PREPROCESS || type == MATCH))
+            return parallel_compute(type, params, wakeAll);
+
         int compute_count = 0;
         active_count = 0;
         MessageBufT* mbuf = (MessageBufT*)get_message_buffer();
@@ -121,23 +394,7 @@ public:
                 compute_count ++;
                 //if (type == ENUMERATE && global_step_num == 4)
                 //cout << vertexes[i]->id.vID << " ";
-                switch (type)
-				{
-				case PREPROCESS:
-                    vertexes[i]->preprocess(v_msgbufs[i], params);
-					break;
-                case FILTER:
-                	vertexes[i]->filter(v_msgbufs[i]);
-					break;
-				case MATCH:
-					vertexes[i]->compute(v_msgbufs[i], params);
-					break;
-				case ENUMERATE:
-					vertexes[i]->enumerate(v_msgbufs[i]);
-					break;
-				}
-                //clear used msgs
-                v_msgbufs[i].clear();
+                compute_vertex(type, vertexes[i], v_msgbufs[i], params);
                 
 				if (vertexes[i]->is_active())
 					active_count++;
@@ -155,10 +412,52 @@ public:
             active_count++;
     }
 
+    //MPI_User_function of AGG_POD
+    static void agg_pod_op(void* in, void* inout, int* len, MPI_Datatype* type)
+    {
+        AggregatorT* agg = (AggregatorT*)get_aggregator();
+        int size = agg->pod_size();
+        for (int i = 0; i < *len; i++)
+            agg->pod_combine((char*)in + i * size, (char*)inout + i * size);
+    }
+
+    //AGG_POD: one allreduce, every worker gets the final directly
+    void agg_sync_pod(AggregatorT* agg)
+    {
+        vector<char> buf(agg->pod_size());
+        agg->to_pod(&buf[0]);
+        all_reduce_pod(&buf[0], buf.size(), agg_pod_op);
+        agg->from_pod(&buf[0]);
+        *((FinalT*)global_agg) = *agg->finishFinal(); //deep copy
+    }
+
+    //AGG_TREE: partials merged up a binomial tree, then the final is
+    //broadcast from MASTER_RANK
+    void agg_sync_tree(AggregatorT* agg)
+    {
+        tree_reduce([&](obinstream& um) {
+            PartialT* part;
+            um >> part;
+            agg->stepFinal(part);
+            delete part;
+        }, [&](ibinstream& m) {
+            m << agg->finishPartial();
+        });
+        if (_my_rank == MASTER_RANK) {
+            *((FinalT*)global_agg) = *agg->finishFinal(); //deep copy
+            masterBcast(*((FinalT*)global_agg));
+        } else
+            slaveBcast(*((FinalT*)global_agg));
+    }
+
     void agg_sync()
     {
         AggregatorT* agg = (AggregatorT*)get_aggregator();
-        if (agg != NULL) {
+        if (agg != NULL && agg->sync_mode() == AGG_POD)
+            agg_sync_pod(agg);
+        else if (agg != NULL && agg->sync_mode() == AGG_TREE)
+            agg_sync_tree(agg);
+        else if (agg != NULL) {
             if (_my_rank != MASTER_RANK) { //send partialT to aggregator
                 //gathering PartialT
                 PartialT* part = agg->finishPartial();
@@ -223,6 +522,7 @@ public:
             add_vertex(v);
     }
 
+#ifndef NO_HDFS
     void load_graph(const char* inpath, const WorkerParams & params)
     {
         hdfsFS fs = getHdfsFS();
@@ -256,6 +556,62 @@ public:
 		hdfsDisconnect(fs);
 		//cout<<"Worker "<<_my_rank<<": \""<<inpath<<"\" loaded"<<endl;//DEBUG !!!!!!!!!!
 	}
+#endif
+
+    //toVertex() on the lines of [first, last), may run in a loader thread
+    void parse_lines(char* first, char* last, vector<VertexT*>& parsed)
+    {
+        while (first < last) {
+            char* nl = (char*)memchr(first, '\n', last - first);
+            char* e = (nl == NULL ? last : nl);
+            *e = '\0';
+            if (e > first) {
+                VertexT* v = toVertex(first);
+                if (v != NULL)
+                    parsed.push_back(v);
+            }
+            first = e + 1;
+        }
+    }
+
+    //cut a block of whole lines into params.threads pieces parsed in parallel
+    void parse_block(char* first, char* last, const WorkerParams & params)
+    {
+        int n = params.threads;
+        vector<char*> cuts(n + 1);
+        cuts[0] = first;
+        cuts[n] = last;
+        for (int i = 1; i < n; i++) {
+            char* p = max(first + (last - first) / n * i, cuts[i - 1]);
+            char* nl = (char*)memchr(p, '\n', last - p);
+            cuts[i] = (nl == NULL ? last : nl + 1);
+        }
+        vector<vector<VertexT*> > parsed(n);
+        vector<thread> loaders;
+        WorkerContext* worker = current_worker();
+        for (int i = 1; i < n; i++)
+            loaders.push_back(thread([&, i, worker]() {
+                adopt_worker(worker);
+                parse_lines(cuts[i], cuts[i + 1], parsed[i]);
+            }));
+        parse_lines(cuts[0], cuts[1], parsed[0]);
+        for (size_t i = 0; i < loaders.size(); i++)
+            loaders[i].join();
+        for (int i = 0; i < n; i++)
+            for (size_t j = 0; j < parsed[i].size(); j++)
+                load_vertex(parsed[i][j]);
+    }
+
+    void load_graph_local(const LocalSplit& split, const WorkerParams & params)
+    {
+        LocalBlockReader reader(split, params.direct, (long long)LOCAL_BLOCK_SIZE * params.threads);
+        char *first, *last;
+        while (reader.nextBlock(first, last))
+            parse_block(first, last, params);
+    }
+
+    //called after the splits are read, before the vertices are shuffled
+    virtual void after_load(VertexContainer& loaded) {}
 
     void load_query_graph_local(const string &inpath)
 	{
@@ -269,12 +625,8 @@ public:
         }
 		
         string line;
-        char c[100];
 		while (getline(myfile, line))
-        {
-            strcpy(c, line.c_str()); 
-			((QueryT*) global_query)->addNode(c);
-        }
+			((QueryT*) global_query)->addNode(&line[0]);
 
         myfile.close();		
 	}
@@ -288,23 +640,28 @@ public:
 
     void dump_partition(const char* outpath)
     {
+#ifndef NO_HDFS
         hdfsFS fs = getHdfsFS();
         BufferedWriter* writer = new BufferedWriter(outpath, fs, _my_rank);
+#else
+        BufferedWriter* writer = new BufferedWriter(outpath, _my_rank);
+#endif
 
         for (VertexIter it = vertexes.begin(); it != vertexes.end(); it++) {
             writer->check();
             toline(*it, *writer);
         }
         delete writer;
+#ifndef NO_HDFS
         hdfsDisconnect(fs);
+#endif
     }
     //=======================================================
 
-    // run the worker, load the data graph
-    void load_data(const WorkerParams & params)
+    // dispatch the splits of the data graph and read the assigned ones
+    void load_data_HDFS(const string& input_path, const WorkerParams & params)
     {
-    	const string& input_path = params.data_path;
-        
+#ifndef NO_HDFS
         //check path + init
         if (_my_rank == MASTER_RANK) {
             if (dirCheck(input_path.c_str()) == -1)
@@ -334,6 +691,50 @@ public:
                  it != assignedSplits.end(); it++)
                 load_graph(it->c_str(), params);
         }
+#else
+        exit_no_HDFS();
+#endif
+    }
+
+    void load_data_local(const string& input_path, const WorkerParams & params)
+    {
+        //check path + init
+        if (_my_rank == MASTER_RANK) {
+            if (localDirCheck(input_path.c_str()) == -1)
+                exit(-1);
+        }
+
+        //dispatch splits
+        vector<LocalSplit> assignedSplits;
+        if (_my_rank == MASTER_RANK) {
+            vector<vector<LocalSplit> >* arrangement = localDispatch(input_path.c_str());
+            masterScatter(*arrangement);
+            assignedSplits.swap((*arrangement)[0]);
+            delete arrangement;
+        } else
+            slaveScatter(assignedSplits);
+        //reading assigned splits (map)
+        for (size_t i = 0; i < assignedSplits.size(); i++)
+            load_graph_local(assignedSplits[i], params);
+    }
+
+    void exit_no_HDFS()
+    {
+        if (_my_rank == MASTER_RANK)
+            cout << "Built without HDFS (NO_HDFS), please use \"-input local\"." << endl;
+        exit(-1);
+    }
+
+    // run the worker, load the data graph
+    void load_data(const WorkerParams & params)
+    {
+    	const string& input_path = params.data_path;
+
+        if (params.input)
+            load_data_HDFS(input_path, params);
+        else
+            load_data_local(input_path, params);
+        after_load(vertexes);
 
         //send vertices according to hash_id (reduce)
         sync_graph();
@@ -352,6 +753,7 @@ public:
 		{
             if (input_HDFS)
             {
+#ifndef NO_HDFS
                 if (dirCheck(input_path.c_str()) == -1)
 				    exit(-1);
 
@@ -363,6 +765,9 @@ public:
                 {
                     load_query_graph_HDFS(it->c_str());
                 }
+#else
+                exit_no_HDFS();
+#endif
             }
             else
             {
@@ -386,10 +791,11 @@ public:
 
     //====================================================================
 
-    void build_query_tree(const string &order, bool pseudo, int &depth, int &bn)
+    void build_query_tree(const WorkerParams & params, int &depth, int &bn)
 	{
     	QueryT* query = (QueryT*) global_query;
-		query->init(order, pseudo);
+		query->init(params.order, params.pseudo, params.symmetry > 0,
+			params.leaf);
 
         depth = query->max_level + 1;
         bn = query->max_branch_number;
@@ -423,6 +829,7 @@ public:
         long long step_vadd_num;
         long long global_msg_num = 0;
         long long global_vadd_num = 0;
+        long long global_byte_num = 0;
         ResetTimer(AGG_TIMER);
         AggregatorT* agg = (AggregatorT*)get_aggregator();
         agg->init();
@@ -434,6 +841,7 @@ public:
         {
             global_step_num++;
             ResetTimer(SUPERSTEP_TIMER);
+            metrics_step_begin();
 
             // stopping criteria for MATCH and ENUMRATE
             StartTimer(STOP_CRITERIA_TIMER);        
@@ -448,22 +856,16 @@ public:
             int wakeAll = getBit(WAKE_ALL_ORBIT, bits_bor);
             */
             int wakeAll = global_step_num == 1;
-            if (wakeAll == 0) 
-            {
-                active_vnum() = all_sum(active_count);
-                /*
-                if (active_vnum() == 0 && getBit(HAS_MSG_ORBIT, bits_bor) == 0)
-                {
-                    StopTimer(STOP_CRITERIA_TIMER);
-                    break; //all_halt AND no_msg, note that received msgs are not freed
-                }
-                */
-            } else
+            //otherwise, active_vnum() came with the control of the last superstep
+            if (wakeAll == 1)
                 active_vnum() = get_vnum();
             clearBits();
+            long long step_bytes = _total_bytes_sent;
             StopTimer(STOP_CRITERIA_TIMER);        
             
             StartTimer(ACTIVE_COMPUTE_TIMER);
+            if (type == MATCH && params.balance > 0 && _num_workers > 1 && wakeAll == 0)
+                balance_load(params);
             int compute_count = active_compute(type, params, wakeAll);
 /* DEBUG
             if (_my_rank < 5 && params.report > 0 && (type == MATCH || type == ENUMERATE)) 
@@ -473,19 +875,10 @@ public:
             }
 */
             StopTimer(ACTIVE_COMPUTE_TIMER);
+            long long local_msg_num = message_buffer->get_total_msg();
+            long long local_vadd_num = message_buffer->get_total_vadd();
             
-            StartTimer(REDUCE_MESSAGE_TIMER);
             //message_buffer->combine();
-            if (params.report == 2)
-            {
-                step_msg_num = master_sum_LL(message_buffer->get_total_msg());
-                step_vadd_num = master_sum_LL(message_buffer->get_total_vadd());
-                if (_my_rank == MASTER_RANK) {
-                    global_msg_num += step_msg_num;
-                    global_vadd_num += step_vadd_num;
-                }
-            }
-            StopTimer(REDUCE_MESSAGE_TIMER);   
 
             vector<vector<msgpair<MessageT>>> &out_messages = 
                 message_buffer->out_messages.getBufs();
@@ -521,10 +914,26 @@ public:
             to_add.clear();
 
             //===================
+            //one allreduce for the whole control plane, it is also the
+            //barrier of the superstep
             StartTimer(SYNC_TIMER);
-            worker_barrier();
+            StepControl ctrl;
+            ctrl.active = active_count;
+            ctrl.has_msg = getBit(HAS_MSG_ORBIT, global_bor_bitmap);
+            ctrl.terminate = getBit(FORCE_TERMINATE_ORBIT, global_bor_bitmap);
+            ctrl.msg_num = local_msg_num;
+            ctrl.vadd_num = local_vadd_num;
+            ctrl.bytes = _total_bytes_sent - step_bytes;
+            all_sum_control(ctrl);
             StopTimer(SYNC_TIMER);
+            active_vnum() = ctrl.active;
+            step_msg_num = ctrl.msg_num;
+            step_vadd_num = ctrl.vadd_num;
+            global_msg_num += step_msg_num;
+            global_vadd_num += step_vadd_num;
+            global_byte_num += ctrl.bytes;
             StopTimer(SUPERSTEP_TIMER);
+            metrics_step_end(type, global_step_num, local_msg_num, local_vadd_num);
             /* DEBUG Timer
             if (_my_rank == MASTER_RANK && params.report > 0 && (type == MATCH || type == ENUMERATE)) {
                 cout << "Superstep " << global_step_num << " done."
@@ -535,6 +944,8 @@ public:
                          << step_vadd_num << endl;
             }
             */
+            if (ctrl.terminate > 0 || (ctrl.active == 0 && ctrl.has_msg == 0))
+                break; //all_halt AND no_msg, the same on every worker
         } // end of while loop
         StartTimer(AGG_TIMER);
         agg_sync();
@@ -563,17 +974,42 @@ public:
             PrintTimer("    - Serialization Time", SERIALIZATION_TIMER);
             PrintTimer("    - Transfer Time", TRANSFER_TIMER);
             cout << "Total #msgs=" << global_msg_num << ", "
-                "Total #vadd=" << global_vadd_num << endl;
+                "Total #vadd=" << global_vadd_num << ", "
+                "Total #bytes=" << global_byte_num << endl;
     	}
         */
     }
 
+    // gather the per-superstep metrics of all workers to MASTER, 
+    // who writes them into one file
+    void dump_metrics(const string& metrics_path)
+    {
+        if (_my_rank == MASTER_RANK) {
+            vector<vector<StepMetrics> > parts(_num_workers);
+            masterGather(parts);
+            vector<StepMetrics> all;
+            for (int i = 0; i < _num_workers; i++) {
+                if (i == MASTER_RANK)
+                    all.insert(all.end(), _step_metrics.begin(), _step_metrics.end());
+                else
+                    all.insert(all.end(), parts[i].begin(), parts[i].end());
+            }
+            write_metrics(metrics_path, all);
+            cout << "Metrics written to " << metrics_path << endl;
+        } else
+            slaveGather(_step_metrics);
+    }
+
     void dump_graph(const string& output_path, bool force_write)
     {
     	//check path + init
         if (_my_rank == MASTER_RANK) {
             cout << "output path: " << output_path << endl;
+#ifndef NO_HDFS
             if (dirCheck(output_path.c_str(), force_write) == -1)
+#else
+            if (localOutDirCheck(output_path.c_str(), force_write) == -1)
+#endif
                 exit(-1);
         }
         dump_partition(output_path.c_str());
@@ -582,11 +1018,13 @@ public:
 private:
     HashT hash;
     VertexContainer vertexes;
+    GhostMap ghosts;
     int active_count;
 
     MessageBuffer<VertexT>* message_buffer;
     Combiner<MessageT>* combiner;
     AggregatorT* aggregator;
+    TaskScheduler* scheduler; //of parallel_compute, NULL until its first call
 };
 
 #endif
@@ -1,11 +1,11 @@
 #include "basic/pregel-dev.h"
 #include "utils/type.h"
 #include "utils/Query.h"
+#include "utils/profile.h"
+#include "utils/tokenizer.h"
 using namespace std;
 
 #define LEVEL (step_num()-1)
-#define START_TIMING(T) (T) = get_current_time();
-#define STOP_TIMING(A, T, X, Y) (A)->addTime((X), (Y), get_current_time() - (T));
 #define MPRINT(str) \
 	if (get_worker_id() == MASTER_RANK) \
 		printf("%s\n", (str));
@@ -25,6 +25,7 @@ using namespace std;
 
 #include "SItypes/SIKey.h"
 #include "SItypes/SIValue.h"
+#include "SItypes/SIMarker.h"
 #include "SItypes/SIBranch.h"
 #include "SItypes/SIQuery.h"
 #include "SItypes/SIAggregator.h"
@@ -40,6 +41,8 @@ using namespace std;
 class SIVertex:public Vertex<SIKey, SIValue, SIMessage, SIKeyHash>
 {
 public:
+	typedef hash_map<int, SIVertex*> GhostMap;
+
 	SICandidate *candidate;
 	long mapping_count = 0;
 	
@@ -52,6 +55,11 @@ public:
 	// for conflicts
 	vector<int> mapped_us;
 
+	// selection words computed by helper workers (-balance) in this step,
+	// by message index: words [pre_from[k], end) of message k are done
+	vector<vector<uint64_t>> pre_sel;
+	vector<int> pre_from;
+
 	void preprocess(MessageContainer & messages, WorkerParams &params)
 	{		
 		//convert vector to set
@@ -68,16 +76,29 @@ public:
 	}
 
 	bool check_feasibility(int *mapping, int query_u, int vID)
-	{ // check vertex uniqueness and backward neighbors 
+	{
+		return check_feasibility(mapping, query_u, vID, this->value());
+	}
+
+	bool check_feasibility(int *mapping, int query_u, int vID, SIValue &val)
+	{ // check vertex uniqueness and backward neighbors (adjacency of val)
 		SIQuery* query = (SIQuery*)getQuery();
 		// check vertex uniqueness
-		for (int &b_level : query->getBSameLabPos(query_u))
+		for (int b_level : query->getBSameLabPos(query_u))
 			if (vID == mapping[b_level])
 				return false;
 
 		// check backward neighbors
-		for (int &b_level : query->getBNeighborsPos(query_u))
-			if (! this->value().hasNeighbor(mapping[b_level]))
+		for (int b_level : query->getBNeighborsPos(query_u))
+			if (! val.hasNeighbor(mapping[b_level]))
+				return false;
+
+		// check symmetry breaking
+		for (int b_level : query->getSymLessPos(query_u))
+			if (mapping[b_level] >= vID)
+				return false;
+		for (int b_level : query->getSymGreaterPos(query_u))
+			if (mapping[b_level] <= vID)
 				return false;
 		return true;
 	}
@@ -98,45 +119,45 @@ public:
 		return dummyID;
 	}
 
-	SIMessage copy_message(SIMessage msg)
-	{
-		int new_ncol;
+	int get_out_ncol(SIMessage &msg)
+	{ // ncol of the mappings as the receiver of msg will see them
 		switch (msg.type)
 		{
 			case BMAPPING_W_SELF:
-				new_ncol = msg.chd_constraint.size() + 3;
-				break;
+				return msg.chd_constraint.size() + 3;
 			case BMAPPING_WO_SELF:
-				new_ncol = msg.chd_constraint.size() + 2;
-				break;
-			case OUT_MAPPING:
-				new_ncol = msg.ncol + 1;
-				break;		
+				return msg.chd_constraint.size() + 2;
+			default: // OUT_MAPPING
+				return msg.ncol + 1;
 		}
+	}
 
-		int *mappings = new int[msg.nrow * new_ncol];
-
+	void extract_out_row(SIMessage &msg, int i, int *row)
+	{ // fill row with the i-th mapping as the receiver of msg will see it
+		int j = 0;
 		if (msg.type == OUT_MAPPING)
 		{
-			for (int i = 0, j; i < msg.nrow; i++)
-			{
-				for (j = 0; j < msg.ncol; j++)
-					mappings[i*new_ncol + j] = ((*msg.passed_mappings)[i])[j];
-				mappings[i*new_ncol + j] = msg.vID;
-			}
+			for (; j < msg.ncol; j++)
+				row[j] = ((*msg.passed_mappings)[i])[j];
+			row[j] = msg.vID;
 		}
 		else
 		{
-			for (int i = 0, j; i < msg.nrow; i++, j=0)
-			{
-				for (int k : msg.chd_constraint)
-					mappings[i*new_ncol + j++] = ((*msg.passed_mappings)[i])[k];
-				if (msg.type == BMAPPING_W_SELF)
-					mappings[i*new_ncol + j++] = msg.vID;
-				mappings[i*new_ncol + j++] = (*msg.dummy_vs)[i];
-				mappings[i*new_ncol + j] = msg.wID;
-			}
+			for (int k : msg.chd_constraint)
+				row[j++] = ((*msg.passed_mappings)[i])[k];
+			if (msg.type == BMAPPING_W_SELF)
+				row[j++] = msg.vID;
+			row[j++] = (*msg.dummy_vs)[i];
+			row[j] = msg.wID;
 		}
+	}
+
+	SIMessage copy_message(SIMessage msg)
+	{
+		int new_ncol = get_out_ncol(msg);
+		int *mappings = new int[msg.nrow * new_ncol];
+		for (int i = 0; i < msg.nrow; i++)
+			extract_out_row(msg, i, mappings + i*new_ncol);
 
 		/* Print out the copied message
 		cout << "[Message]" << endl;
@@ -150,6 +171,87 @@ public:
 			msg.curr_u, msg.nrow, new_ncol, msg.is_delete, msg.markers);
 	}
 
+	void send_to_ghosts(int wID, vector<int> &keys, SIMessage &msg)
+	{
+		// For keys mirrored on this worker (hubs), check feasibility here 
+		// and ship only the passing rows to the hub's owner.
+		// Handled keys are removed from keys, the rest share msg as usual.
+		SIQuery* query = (SIQuery*)getQuery();
+		if (query->getBNeighborsPos(msg.curr_u).empty() &&
+			query->getBSameLabPos(msg.curr_u).empty() &&
+			query->getSymLessPos(msg.curr_u).empty() &&
+			query->getSymGreaterPos(msg.curr_u).empty())
+			return; // every row passes
+
+		GhostMap *ghosts = (GhostMap*)getGhosts();
+		const int W = query->marker_words;
+		vector<int> row = vector<int>(get_out_ncol(msg));
+		bool is_branch = (msg.type != OUT_MAPPING);
+		size_t k = 0;
+		for (size_t ki = 0; ki < keys.size(); ki++)
+		{
+			int vID = keys[ki];
+			auto it = ghosts->find(vID);
+			if (it == ghosts->end())
+			{
+				keys[k++] = vID;
+				continue;
+			}
+
+			SIValue &hub = it->second->value();
+			vector<int*>* passed_mappings = new vector<int*>();
+			vector<int>* markers = new vector<int>();
+			vector<int>* dummy_vs = is_branch ? new vector<int>() : NULL;
+			for (int i = 0; i < msg.nrow; i++)
+			{
+				extract_out_row(msg, i, &row[0]);
+				if (check_feasibility(&row[0], msg.curr_u, vID, hub))
+				{
+					passed_mappings->push_back((*msg.passed_mappings)[i]);
+					marker_append(*markers, &(*msg.markers)[i*W], W);
+					if (is_branch)
+						dummy_vs->push_back((*msg.dummy_vs)[i]);
+				}
+			}
+
+			if (passed_mappings->size() == msg.nrow)
+				keys[k++] = vID; // nothing saved, keep sharing msg
+			else if (!passed_mappings->empty())
+			{
+				send_messages(wID, {vID}, SIMessage(msg.type, passed_mappings, 
+					dummy_vs, msg.curr_u, passed_mappings->size(), msg.ncol,
+					msg.vID, msg.wID, markers, msg.chd_constraint));
+				continue;
+			}
+			delete passed_mappings;
+			delete markers;
+			delete dummy_vs;
+		}
+		keys.resize(k);
+	}
+
+	int countFoldedLeaf(int *mapping, int query_u)
+	{ // #neighbors check_feasibility would accept for the folded leaf
+		// query_u, from the label range: symmetry breaking bounds the
+		// vIDs, and each same-label vertex of the mapping in the bounds
+		// that is a neighbor is excluded
+		SIQuery* query = (SIQuery*)getQuery();
+		int lo = INT_MIN, hi = INT_MAX;
+		for (int b_level : query->getSymLessPos(query_u))
+			lo = max(lo, mapping[b_level]);
+		for (int b_level : query->getSymGreaterPos(query_u))
+			hi = min(hi, mapping[b_level]);
+		pair<int, int> range = value().labelRange(query->getLabel(query_u), lo, hi);
+		int n = range.second - range.first;
+		for (int b_level : query->getBSameLabPos(query_u))
+		{
+			int vID = mapping[b_level];
+			if (vID > lo && vID < hi && value().hasNeighbor(vID))
+				n--;
+		}
+		return max(n, 0);
+	}
+
 	void addPsdChildren(SIBranch *b, int u_index, int msg_vID, int msg_wID, 
 		int result_index)
 	{
@@ -169,11 +271,11 @@ public:
 				// Construct neighbors_map: 
 				// Loop through neighbors and select out ones 
 				// with right labels && FEASIBLE
-				for (int j = 0; j < value().degree; ++j)
+				pair<int, int> range = value().labelRange(label);
+				for (int j = range.first; j < range.second; ++j)
 				{
 					KeyLabel &kl = value().nbs_vector[j];
-					if ((label == kl.label) && 
-						check_feasibility(b->mapping, ps_chd, kl.key.vID))
+					if (check_feasibility(b->mapping, ps_chd, kl.key.vID))
 						neighbors_map[kl.key.wID].push_back(kl.key.vID);
 				}
 				// send messages to neighbors
@@ -187,16 +289,23 @@ public:
 						msg_vID, msg_wID, result_index, chd_sz+i));
 				}
 			}
+			else if (query->getChdFolded(b->curr_u)[chd_sz+i])
+			{
+				int type = query->getChdTypes(b->curr_u)[chd_sz+i];
+				int n = (type > 0) ? countFoldedLeaf(b->mapping, ps_chd) : -1;
+				if (n != 0) // the state has no choice if no candidate
+					b->unmarked_branches[chd_sz+i].push_back(make_pair(n, 0));
+			}
 			else
 			{
 				int type = query->getChdTypes(b->curr_u)[chd_sz+i];
 				if (type > 0)
 				{
-					for (int ni = 0; ni < value().degree; ni++)
+					pair<int, int> range = value().labelRange(label);
+					for (int ni = range.first; ni < range.second; ni++)
 					{
 						KeyLabel &kl = value().nbs_vector[ni];
-						if ((label == kl.label) && 
-							check_feasibility(b->mapping, ps_chd, kl.key.vID))
+						if (check_feasibility(b->mapping, ps_chd, kl.key.vID))
 							b->unmarked_branches[chd_sz+i]
 								.push_back(make_pair(kl.key.vID, 0));
 					}
@@ -208,11 +317,263 @@ public:
 		}
 	}
 
+	//=====================================================================
+	// MATCH kernels: the feasibility loop over the rows received by one
+	// bucket, specialized at compile time on the kind of the query vertex
+	// and on the number of same-label (NS) and backward-neighbor (NB)
+	// positions to check; -1 is the generic, runtime-sized fallback.
+	// Rows are first filtered by select_rows(), then compacted.
+	// One kernel is selected per query vertex by select_match_kernels().
+	enum MATCH_KINDS { KIND_OTHER = 0, KIND_LEAF = 1, KIND_BRANCH = 2 };
+
+	typedef void (SIVertex::*MatchKernel)(MessageContainer &messages,
+		vector<int> &msg_indices, int curr_u, const int *conflict_set,
+		vector<int*>* passed_mappings, vector<int>* markers,
+		vector<int>* dummy_vs, int final_index);
+
+	WORKER_LOCAL_MEMBER(vector<MatchKernel>, match_kernels); // indexed by query vertex
+
+	// rows filtered per row-range task in a parallel superstep (64 per word)
+	static const int TASK_WORDS = 64;
+
+	// columnar feasibility stage of the kernels: evaluates the predicates
+	// of curr_u over the words [w0, w1) of a block of nrow rows, column by
+	// column, into a selection bitmap (bit i of word i/64 = row i passes);
+	// lp/gp: columns that must hold a smaller/larger vertex (symmetry)
+	template <int NS, int NB>
+	void select_rows(const int *rows, int nrow, int ncol, int w0, int w1,
+		const int *sp, int ns, const int *np, int nb, const int *lp, int nl,
+		const int *gp, int ng, uint64_t *sel)
+	{
+		ns = (NS >= 0 ? NS : ns);
+		nb = (NB >= 0 ? NB : nb);
+		const int vID = id.vID;
+		for (int w = w0; w < w1; w++)
+			sel[w] = ~0ULL;
+		if (w1 * 64 > nrow)
+			sel[w1-1] = (1ULL << (nrow % 64)) - 1;
+
+		// vertex uniqueness: branch-free compares, 64 rows per word
+		for (int k = 0; k < ns; k++)
+		{
+			const int *col = rows + sp[k];
+			for (int w = w0; w < w1; w++)
+			{
+				int n = min(64, nrow - w*64);
+				const int *c = col + (size_t)w*64*ncol;
+				uint64_t bits = 0;
+				for (int j = 0; j < n; j++)
+					bits |= (uint64_t)(c[j*ncol] != vID) << j;
+				sel[w] &= bits;
+			}
+		}
+
+		// symmetry breaking: the same, with order compares
+		for (int k = 0; k < nl + ng; k++)
+		{
+			const int *col = rows + (k < nl ? lp[k] : gp[k-nl]);
+			for (int w = w0; w < w1; w++)
+			{
+				int n = min(64, nrow - w*64);
+				const int *c = col + (size_t)w*64*ncol;
+				uint64_t bits = 0;
+				if (k < nl)
+					for (int j = 0; j < n; j++)
+						bits |= (uint64_t)(c[j*ncol] < vID) << j;
+				else
+					for (int j = 0; j < n; j++)
+						bits |= (uint64_t)(c[j*ncol] > vID) << j;
+				sel[w] &= bits;
+			}
+		}
+
+		// backward neighbors: only on survivors, a column often repeats
+		// the same data vertex (shared prefix), so the last probe is reused
+		SIValue &val = value();
+		for (int k = 0; k < nb; k++)
+		{
+			const int *col = rows + np[k];
+			int last = INT_MIN;
+			bool last_ok = false;
+			for (int w = w0; w < w1; w++)
+			{
+				uint64_t m = sel[w];
+				while (m != 0)
+				{
+					int j = __builtin_ctzll(m);
+					m &= m - 1;
+					int u = col[(size_t)(w*64 + j)*ncol];
+					if (u != last)
+					{
+						last = u;
+						last_ok = val.hasNeighbor(u);
+					}
+					if (!last_ok)
+						sel[w] &= ~(1ULL << j);
+				}
+			}
+		}
+	}
+
+	// selection bitmaps of a whole bucket, sels[k] for the k-th message;
+	// in a parallel superstep, the words of a large bucket are cut into
+	// row-range tasks that idle threads steal
+	template <int NS, int NB>
+	void select_bucket(MessageContainer &messages, vector<int> &msg_indices,
+		int curr_u, vector<vector<uint64_t>> &sels)
+	{
+		SIQuery* query = (SIQuery*)getQuery();
+		IntSpan sp = query->getBSameLabPos(curr_u);
+		IntSpan np = query->getBNeighborsPos(curr_u);
+		IntSpan lp = query->getSymLessPos(curr_u);
+		IntSpan gp = query->getSymGreaterPos(curr_u);
+		int m = msg_indices.size();
+		// a reference, the tasks may run on other threads
+		static thread_local vector<int> offsets_tl;
+		vector<int> &word_offsets = offsets_tl;
+		word_offsets.assign(m + 1, 0);
+		for (int k = 0; k < m; k++)
+		{
+			int msgi = msg_indices[k];
+			int nw = (messages[msgi].nrow + 63) / 64;
+			sels[k].resize(nw);
+			if (!pre_sel.empty() && !pre_sel[msgi].empty())
+			{ // the tail was shipped to a helper
+				copy(pre_sel[msgi].begin() + pre_from[msgi], pre_sel[msgi].end(),
+					sels[k].begin() + pre_from[msgi]);
+				nw = pre_from[msgi];
+			}
+			word_offsets[k+1] = word_offsets[k] + nw;
+		}
+
+		parallel_for(word_offsets[m], TASK_WORDS, [&](int first, int last) {
+			int k = upper_bound(word_offsets.begin(), word_offsets.end(), first)
+				- word_offsets.begin() - 1;
+			for (; k < m && word_offsets[k] < last; k++)
+			{
+				SIMessage &msg = messages[msg_indices[k]];
+				int w0 = max(first, word_offsets[k]) - word_offsets[k];
+				int w1 = min(last, word_offsets[k+1]) - word_offsets[k];
+				if (w0 < w1)
+					select_rows<NS, NB>(msg.mappings, msg.nrow, msg.ncol, w0, w1,
+						sp.begin(), sp.size(), np.begin(), np.size(),
+						lp.begin(), lp.size(), gp.begin(), gp.size(), &sels[k][0]);
+			}
+		});
+	}
+
+	template <int KIND, int NS, int NB>
+	void match_kernel(MessageContainer &messages, vector<int> &msg_indices,
+		int curr_u, const int *conflict_set, vector<int*>* passed_mappings,
+		vector<int>* markers, vector<int>* dummy_vs, int final_index)
+	{
+		const int vID = id.vID;
+		const int W = ((SIQuery*)getQuery())->marker_words;
+		vector<int> row_marker = vector<int>(W); // marker of the new mapping
+		static thread_local vector<vector<uint64_t>> sels;
+		if (sels.size() < msg_indices.size())
+			sels.resize(msg_indices.size());
+		select_bucket<NS, NB>(messages, msg_indices, curr_u, sels);
+
+		// compact the survivors in one pass
+		for (size_t k = 0; k < msg_indices.size(); k++)
+		{
+			SIMessage &msg = messages[msg_indices[k]];
+			const int ncol = msg.ncol;
+			vector<int> &in_markers = *msg.markers;
+			vector<uint64_t> &sel = sels[k];
+			for (size_t w = 0; w < sel.size(); w++)
+			{
+				uint64_t m = sel[w];
+				while (m != 0)
+				{
+					int i = w*64 + __builtin_ctzll(m);
+					m &= m - 1;
+					int *new_mapping = msg.mappings + i*ncol;
+					marker_or(&row_marker[0], &in_markers[i*W], conflict_set, W);
+
+					if (KIND == KIND_BRANCH)
+					{
+						passed_mappings->push_back(new_mapping);
+						marker_append(*markers, NULL, W); // zero out at dummy
+
+						SIBranch* b = new SIBranch(new_mapping, vID,
+							ncol, curr_u, &row_marker[0]);
+						int dummyID = build_dummy_vertex(b);
+						dummy_vs->push_back(dummyID);
+						addPsdChildren(b, 0, dummyID, id.wID, 0);
+#ifdef DEBUG_MODE_BRANCH
+						b->print();
+#endif
+					}
+					else if (KIND == KIND_LEAF)
+					{
+						SIBranch* b = new SIBranch(new_mapping, vID,
+							ncol, curr_u, &row_marker[0]);
+						addPsdChildren(b, final_index, vID, id.wID,
+							this->final_results[final_index].size());
+						this->final_results[final_index].push_back(b);
+#ifdef DEBUG_MODE_BRANCH
+						b->print();
+#endif
+					}
+					else
+					{
+						passed_mappings->push_back(new_mapping);
+						marker_append(*markers, &row_marker[0], W);
+					}
+				}
+			}
+		}
+	}
+
+	template <int KIND, int NS>
+	static MatchKernel select_kernel(int nb)
+	{
+		switch (nb)
+		{
+			case 0: return &SIVertex::match_kernel<KIND, NS, 0>;
+			case 1: return &SIVertex::match_kernel<KIND, NS, 1>;
+			case 2: return &SIVertex::match_kernel<KIND, NS, 2>;
+			case 3: return &SIVertex::match_kernel<KIND, NS, 3>;
+			default: return &SIVertex::match_kernel<KIND, NS, -1>;
+		}
+	}
+
+	template <int KIND>
+	static MatchKernel select_kernel(int ns, int nb)
+	{
+		switch (ns)
+		{
+			case 0: return select_kernel<KIND, 0>(nb);
+			case 1: return select_kernel<KIND, 1>(nb);
+			case 2: return select_kernel<KIND, 2>(nb);
+			case 3: return select_kernel<KIND, 3>(nb);
+			default: return select_kernel<KIND, -1>(nb);
+		}
+	}
+
+	// call once the query tree is built, on every worker
+	static void select_match_kernels(SIQuery* query)
+	{
+		match_kernels.resize(query->nodes.size());
+		for (int u = 0; u < query->nodes.size(); u++)
+		{
+			int ns = query->getBSameLabPos(u).size();
+			int nb = query->getBNeighborsPos(u).size();
+			if (query->isBranch(u))
+				match_kernels[u] = select_kernel<KIND_BRANCH>(ns, nb);
+			else if (query->isLeaf(u))
+				match_kernels[u] = select_kernel<KIND_LEAF>(ns, nb);
+			else
+				match_kernels[u] = select_kernel<KIND_OTHER>(ns, nb);
+		}
+	}
+	//=====================================================================
+
 	virtual void compute(MessageContainer &messages, WorkerParams &params)
 	{
 		SIQuery* query = (SIQuery*)getQuery();
-		SIAgg* agg = (SIAgg*)get_aggregator();
-		double t, t1, t2;
 
 #ifdef DEBUG_MODE_ACTIVE
 		cout << "[DEBUG] STEP NUMBER " << step_num()
@@ -222,7 +583,7 @@ public:
 #endif
 
 		if (id.vID < 0) //that newly built dummy vertex
-		{
+		{ // only pseudo responses
 			for (int i = 0; i < messages.size(); i++)
 			{
 				SIMessage &msg = messages[i];
@@ -233,11 +594,12 @@ public:
 				if (msg.type == PSD_RESPONSE)
 				{
 					SIBranch *b = this->final_results[msg.u_index][msg.nrow];
-					pair<int, int> p = make_pair(msg.vID, msg.curr_u);
-					if (msg.curr_u == 0)
-						b->unmarked_branches[msg.ncol].push_back(p);
+					const int *marker = &msg.chd_constraint[0];
+					if (marker_empty(marker, query->marker_words))
+						b->unmarked_branches[msg.ncol].push_back(
+							make_pair(msg.vID, 0));
 					else
-						b->marked_branches[msg.ncol].push_back(p);
+						b->addPsdMarked(msg.ncol, msg.vID, marker);
 				}
 			}
 			vote_to_halt();
@@ -245,8 +607,8 @@ public:
 		}
 
 		// arrange messages
-		START_TIMING(t);
-		vector<int> vector_u = query->getBucket(LEVEL, value().label);
+		PROFILE_BEGIN(ZONE_ARRANGE_MESSAGES)
+		IntSpan vector_u = query->getBucket(LEVEL, value().label);
 		int n_u = vector_u.size();
 		int curr_u;
 		vector<vector<int>> messages_classifier = vector<vector<int>>(n_u);
@@ -255,6 +617,7 @@ public:
 			if ((!params.filter) && 
 				(value().label != query->getLabel(query->root)))
 			{
+				PROFILE_END(ZONE_ARRANGE_MESSAGES)
 				vote_to_halt();
 				return;
 			}
@@ -271,11 +634,12 @@ public:
 				if (msg.type == PSD_RESPONSE)
 				{
 					SIBranch *b = this->final_results[msg.u_index][msg.nrow];
-					pair<int, int> p = make_pair(msg.vID, msg.curr_u);
-					if (msg.curr_u == 0)
-						b->unmarked_branches[msg.ncol].push_back(p);
+					const int *marker = &msg.chd_constraint[0];
+					if (marker_empty(marker, query->marker_words))
+						b->unmarked_branches[msg.ncol].push_back(
+							make_pair(msg.vID, 0));
 					else
-						b->marked_branches[msg.ncol].push_back(p);
+						b->addPsdMarked(msg.ncol, msg.vID, marker);
 				}
 				else
 				{
@@ -284,20 +648,26 @@ public:
 				}
 			}
 		}
-		STOP_TIMING(agg, t, 0, 0);
+		PROFILE_END(ZONE_ARRANGE_MESSAGES)
 
 		// main computation
 		//cout << "main computation checked" << endl;
-		START_TIMING(t);
+		PROFILE_BEGIN(ZONE_MAIN_COMPUTATION)
 		for (int bucket_num = 0; bucket_num < n_u; bucket_num ++)
 		{
 			if (step_num() != 1 && messages_classifier[bucket_num].empty())
 				continue;
 
 			curr_u = vector_u[bucket_num];
-			int conflict_number = 0;
+			const int W = query->marker_words;
+			// conflicts of curr_u with the query vertices mapped to this one
+			vector<int> conflict_set = vector<int>(W, 0);
 			for (int mapped_u : mapped_us)
-				conflict_number += query->getConflictNumber(curr_u, mapped_u);
+			{
+				int ci = query->getConflictIndex(curr_u, mapped_u);
+				if (ci >= 0)
+					marker_set(&conflict_set[0], ci);
+			}
 			this->mapped_us.push_back(curr_u);
 
 			vector<int> &next_us = query->getChildren(curr_u);
@@ -305,7 +675,7 @@ public:
 
 			vector<int*>* passed_mappings = new vector<int*>();
 			vector<int>* markers = new vector<int>();
-			if (LEVEL == 0) markers->push_back(0);
+			if (LEVEL == 0) marker_append(*markers, NULL, W);
 			vector<int>* dummy_vs = new vector<int>();
 
 			bool is_branch = query->isBranch(curr_u);
@@ -314,28 +684,32 @@ public:
 			//cout << "is_branch : " << is_branch << " is_leaf : " << is_leaf << endl;
 
 			// loop through messages and check feasibilities
-			START_TIMING(t1);
+			PROFILE_BEGIN(ZONE_CHECK_FEASIBILITY)
 			if (is_pseudo)
 			{
 				for (int msgi : messages_classifier[bucket_num])
 				{
 					SIMessage &msg = messages[msgi];
-					send_messages(msg.wID, {msg.vID}, 
-						SIMessage(PSD_RESPONSE, conflict_number, msg.u_index, 
-							id.vID, id.wID, msg.nrow, msg.ncol));
+					SIMessage response = SIMessage(PSD_RESPONSE, curr_u, 
+						msg.u_index, id.vID, id.wID, msg.nrow, msg.ncol);
+					response.chd_constraint = conflict_set; // the marker
+					send_messages(msg.wID, {msg.vID}, response);
 				}
+				PROFILE_END(ZONE_CHECK_FEASIBILITY)
 				continue;
 			}
 
+			// the row loop runs in the kernel selected for curr_u
+			MatchKernel kernel = match_kernels[curr_u];
 			if (is_branch)
 			{
-				START_TIMING(t2);
+				PROFILE_SCOPE(ZONE_CHECK_BRANCH)
 
 				// special case: root branch vertex
 				if (step_num() == 1)
 				{
 					dummy_vs->push_back(id.vID);
-					SIBranch* b = new SIBranch(NULL, id.vID, 0, curr_u, 0);
+					SIBranch* b = new SIBranch(NULL, id.vID, 0, curr_u, NULL);
 					addPsdChildren(b, 0, id.vID, id.wID, 0);
 #ifdef DEBUG_MODE_BRANCH
 					b->print();
@@ -348,80 +722,28 @@ public:
 					this->final_results[0].push_back(b);
 				}
 
-				for (int msgi : messages_classifier[bucket_num])
-				{
-					SIMessage &msg = messages[msgi];
-					for (int i = 0; i < msg.nrow; i++)
-					{
-						int *new_mapping = msg.mappings + i*msg.ncol;
-						//cout << "new_mapping[0]: " << new_mapping[0] << endl;
-						if (check_feasibility(new_mapping, curr_u, id.vID))
-						{
-							passed_mappings->push_back(new_mapping);
-							markers->push_back(0); // zero out at dummy
-
-							SIBranch* b = new SIBranch(new_mapping, id.vID,
-								msg.ncol, curr_u, (*msg.markers)[i] + conflict_number);
-							int dummyID = build_dummy_vertex(b);
-							dummy_vs->push_back(dummyID);
-							addPsdChildren(b, 0, dummyID, id.wID, 0);
-#ifdef DEBUG_MODE_BRANCH
-							b->print();
-#endif
-						}
-					}
-				}
-				STOP_TIMING(agg, t2, 2, 0);
+				(this->*kernel)(messages, messages_classifier[bucket_num], curr_u,
+					&conflict_set[0], passed_mappings, markers, dummy_vs, -1);
 			}
 			else if (is_leaf)
 			{
-				START_TIMING(t2);
+				PROFILE_SCOPE(ZONE_CHECK_LEAF)
 				int final_index = this->final_us.size();
 				this->final_us.push_back(curr_u);
 				this->final_results.push_back(vector<SIBranch*>());
-				for (int msgi : messages_classifier[bucket_num])
-				{
-					SIMessage &msg = messages[msgi];
-					for (int i = 0; i < msg.nrow; i++)
-					{
-						int *new_mapping = msg.mappings + i*msg.ncol;
-						if (check_feasibility(new_mapping, curr_u, id.vID))
-						{
-							SIBranch* b = new SIBranch(new_mapping, id.vID,
-								msg.ncol, curr_u, (*msg.markers)[i] + conflict_number);
-							addPsdChildren(b, final_index, id.vID, id.wID,
-								this->final_results[final_index].size());
-							this->final_results[final_index].push_back(b);
-#ifdef DEBUG_MODE_BRANCH
-							b->print();
-#endif
-						}
-					}
-				}
-				STOP_TIMING(agg, t2, 2, 1);
+				(this->*kernel)(messages, messages_classifier[bucket_num], curr_u,
+					&conflict_set[0], passed_mappings, markers, dummy_vs, final_index);
 			}
 			else // not branch nor leaf
 			{
-				START_TIMING(t2);
-				for (int msgi : messages_classifier[bucket_num])
-				{
-					SIMessage &msg = messages[msgi];
-					for (int i = 0; i < msg.nrow; i++)
-					{
-						int *new_mapping = msg.mappings + i*msg.ncol;
-						if (check_feasibility(new_mapping, curr_u, id.vID))
-						{
-							passed_mappings->push_back(new_mapping);
-							markers->push_back((*msg.markers)[i] + conflict_number);
-						}
-					}
-				}
-				STOP_TIMING(agg, t2, 2, 2);
+				PROFILE_SCOPE(ZONE_CHECK_OTHER)
+				(this->*kernel)(messages, messages_classifier[bucket_num], curr_u,
+					&conflict_set[0], passed_mappings, markers, dummy_vs, -1);
 			}
-			STOP_TIMING(agg, t1, 0, 2);
+			PROFILE_END(ZONE_CHECK_FEASIBILITY)
 
 			//Continue mapping: send mappings to children
-			START_TIMING(t1);
+			PROFILE_BEGIN(ZONE_CONTINUE_MAPPING)
 			if (!passed_mappings->empty() || step_num() == 1)
 			{
 				vector<vector<int>> neighbors_map = vector<vector<int>>(get_num_workers());
@@ -442,7 +764,7 @@ public:
 
 					//Construct neighbors_map: 
 				  	//Loop through neighbors and select out ones with right labels
-				    START_TIMING(t2);
+				    PROFILE_BEGIN(ZONE_NEIGHBOR_MAP)
 					if (params.filter)
 					{ //With filtering
 						hash_set<SIKey> &keys = candidate->candidates[curr_u][next_u];
@@ -452,18 +774,17 @@ public:
 					}
 					else
 					{ //Without filtering
-						int next_label = query->getLabel(next_u);
-						for (int i = 0; i < value().degree; ++i)
+						pair<int, int> range = value().labelRange(query->getLabel(next_u));
+						for (int i = range.first; i < range.second; ++i)
 						{
 							KeyLabel &kl = value().nbs_vector[i];
-							if (kl.label == next_label)
-								neighbors_map[kl.key.wID].push_back(kl.key.vID);
+							neighbors_map[kl.key.wID].push_back(kl.key.vID);
 						}
 					}
-					STOP_TIMING(agg, t2, 1, 1);
+					PROFILE_END(ZONE_NEIGHBOR_MAP)
 
 					//Update out_message_buffer
-					START_TIMING(t2);
+					PROFILE_BEGIN(ZONE_OUT_MESSAGES)
 					SIMessage out_message;
 					if (!is_branch)
 						type = MESSAGE_TYPES::OUT_MAPPING;
@@ -495,9 +816,15 @@ public:
 							send_messages(wID, neighbors_map[wID],
 								copy_message(out_message));
 						else
-							send_messages(wID, neighbors_map[wID], out_message);
+						{
+							// mappings are empty at the root
+							if (getGhosts() != NULL && LEVEL > 0)
+								send_to_ghosts(wID, neighbors_map[wID], out_message);
+							if (!neighbors_map[wID].empty())
+								send_messages(wID, neighbors_map[wID], out_message);
+						}
 					}
-					STOP_TIMING(agg, t2, 1, 2);
+					PROFILE_END(ZONE_OUT_MESSAGES)
 
 					//Clear neighbors_map
 					for (int i = 0; i < get_num_workers(); i++)
@@ -505,10 +832,12 @@ public:
 				}
 			}
 			// end of continue mapping of curr_u
-			STOP_TIMING(agg, t1, 1, 0);
+			PROFILE_END(ZONE_CONTINUE_MAPPING)
 		}
 		// end of for curr_u loop
-		STOP_TIMING(agg, t, 0, 1);
+		PROFILE_END(ZONE_MAIN_COMPUTATION)
+		pre_sel.clear();
+		pre_from.clear();
 		vote_to_halt();
 	}
 
@@ -516,51 +845,53 @@ public:
 	{
 		// set up branch + send or expand
 		SIQuery* query = (SIQuery*)getQuery();
-		SIAgg* agg = (SIAgg*)get_aggregator();
 		vector<int> &branch_senders = query->getBranchSenders(branch->curr_u);
 		int *p = branch->mapping;
-		double t, t1;
 		branch->mapping += offset;
 		branch->ncol -= offset;
 
 		// Phase I: Organize branches (Receive messages)
 		// for msg in msgs: arrange msgs according to msg's u
 		// marked messages
-		START_TIMING(t);
+		PROFILE_BEGIN(ZONE_ORGANIZE_BRANCHES)
 		for (int pi = 0; pi < messages.size(); pi++)
 		{
 			SIMessage &msg = messages[pi];
-			//cout << "Receiving Message " << pi << endl;
-			//msg.branch->print();
-			branch->chd_pointers.push_back(msg.branch);
+			// the packed child is read in place
+			BranchView chd(&(*msg.packed)[0]);
+			branch->chd_views.push_back(chd);
 			
-			if (msg.branch->ncol > 10 || msg.branch->ncol < 0)
+			if (chd.size() != msg.packed->size())
 			{
-				cout << "msg error "  << pi << endl;
-				msg.branch->print();
+				fprintf(stderr, "Corrupt packed branch %d: %d ints, %d received!\n",
+					pi, chd.size(), (int)msg.packed->size());
+				exit(-1);
 			}
 
-			int u = (msg.branch)->curr_u;
+			int u = chd.curr_u();
 			int si; // the state index corresponding to curr_u
 			for (si = 0; si < branch_senders.size() && branch_senders[si] != u; si++);
 
 			if (si == branch_senders.size())
 			{
-				cout << "ERROR!" << endl;
-				msg.branch->print();
+				fprintf(stderr, "Packed branch %d from u%d, not a child of u%d!\n",
+					pi, u, branch->curr_u);
+				exit(-1);
 			}
 			
-			for (int ti : msg.branch->tree_indices)
-				if (msg.branch->tree_markers[ti] == 0) // unmarked
-					branch->unmarked_branches[si].push_back(make_pair(pi, ti));
+			for (int k = 0; k < chd.ntree(); k++)
+			{
+				if (marker_empty(chd.treeMarker(k), chd.words())) // unmarked
+					branch->unmarked_branches[si].push_back(make_pair(pi, k));
 				else // marked
-					branch->marked_branches[si].push_back(make_pair(pi, ti));
+					branch->marked_branches[si].push_back(make_pair(pi, k));
+			}
 		}
-		STOP_TIMING(agg, t, 0, 2);
+		PROFILE_END(ZONE_ORGANIZE_BRANCHES)
 
 		// Phase II: Enumerate Trees
-		START_TIMING(t);
-		int cv = query->getCAOCValue(branch->curr_u);
+		PROFILE_BEGIN(ZONE_ENUMERATE_TREES)
+		const int *cv = query->getCAOCValue(branch->curr_u);
 
 		if (!branch->enumerateTrees(cv)) // invalid branch
 		{
@@ -568,47 +899,52 @@ public:
 			cout << "The branch is invalid. " << endl;
 			branch->print();
 #endif
+			PROFILE_END(ZONE_ENUMERATE_TREES)
 			return;
 		}
-		STOP_TIMING(agg, t, 1, 0);
+		PROFILE_END(ZONE_ENUMERATE_TREES)
 
 #ifdef DEBUG_MODE_BRANCH
 		branch->print();
 #endif
 
 		// Phase III: Send to dummy or expand
-		START_TIMING(t);
+		PROFILE_BEGIN(ZONE_SEND_OR_EXPAND)
 		if (offset == 0)
 		{
-			START_TIMING(t1);
+			PROFILE_SCOPE(ZONE_EXPAND)
 			int k = query->getConflicts().size();
-			for (int ti : branch->tree_indices)
+			static thread_local vector<int> packed; // reused, no allocation
+			packed.clear();
+			branch->pack(packed);
+			BranchView root(&packed[0]);
+			for (int ti = 0; ti < root.ntree(); ti++)
 			{
 				vector<int> conflict_vs = vector<int>(k, -1);
-				int n = branch->expand(ti, conflict_vs);
+				long n = root.expand(ti, conflict_vs);
 				this->mapping_count += n;
 				//cout << "&& ti = " << ti << " n = " << n << endl;
 			}
 #ifdef DEBUG_MODE_RESULT_COUNT
 			cout << "this->mapping_count = " << this->mapping_count << endl;
 #endif
-			STOP_TIMING(agg, t1, 1, 2);
 		}
 		else
 		{
-			START_TIMING(t1);
+			PROFILE_SCOPE(ZONE_SEND_TO_DUMMY)
 			int vID = p[offset-2];
 			int wID = p[offset-1];
-			SIMessage out_msg = SIMessage(BRANCH_RESULT, branch);
+			vector<int> *packed = new vector<int>();
+			branch->pack(*packed);
+			SIMessage out_msg = SIMessage(BRANCH_RESULT, packed);
 			if (wID == get_worker_id())
 				out_msg.is_delete = false;
 			send_messages(wID, {vID}, out_msg);
 #ifdef DEBUG_MODE_MSG
 			cout << "message send to " << vID << endl;
 #endif
-			STOP_TIMING(agg, t1, 2, 0);
 		}
-		STOP_TIMING(agg, t, 1, 1);
+		PROFILE_END(ZONE_SEND_OR_EXPAND)
 	}
 
 	void enumerate(MessageContainer & messages)
@@ -623,7 +959,6 @@ public:
 			 << endl;
 #endif
 		bool to_halt = true;
-		double t;
 
 		// might have multiple leaf u and at most one dummy u
 		for (int i = 0 ; i < this->final_us.size(); i++)
@@ -634,7 +969,7 @@ public:
 			vector<SIBranch*> final_result = this->final_results[i];
 			if (curr_u >= 0) // leaf vertex
 			{
-				START_TIMING(t);
+				PROFILE_SCOPE(ZONE_ENUM_LEAF)
 				int branch_num = query->getBranchNumber(curr_u);
 				if (branch_num + step_num() < query->max_branch_number + 1)
 				{
@@ -651,11 +986,10 @@ public:
 					offset = dummy_pos + 2;
 				for (int j = 0; j < final_result.size(); j++)
 					build_branch(messages, final_result[j], offset);
-				STOP_TIMING(agg, t, 2, 1);
 			}
 			else if (!messages.empty()) // dummy vertex
 			{
-				START_TIMING(t);
+				PROFILE_SCOPE(ZONE_ENUM_DUMMY)
 				SIBranch *b = final_result[0];
 				int dummy_pos = query->getDummyPos(b->curr_u);
 				int offset;
@@ -665,7 +999,10 @@ public:
 					offset = dummy_pos + 2;
 
 				build_branch(messages, b, offset);	
-				STOP_TIMING(agg, t, 0, 1);
+
+				// the packed children are embedded into b or expanded
+				for (SIMessage &msg : messages)
+					delete msg.packed;
 			}
 		}
 
@@ -676,6 +1013,8 @@ public:
 	}
 };
 
+WORKER_LOCAL(vector<SIVertex::MatchKernel>, SIVertex::match_kernels);
+
 //=============================================================================
 
 class SIWorker:public Worker<SIVertex, SIQuery, SIAgg>
@@ -683,36 +1022,175 @@ class SIWorker:public Worker<SIVertex, SIQuery, SIAgg>
 	char buf[100];
 
 	public:
-		// C version
+		// hubs are mirrored on every worker (ghost mirroring)
+		virtual bool to_ghost(SIVertex* v)
+		{
+			return v->value().degree > get_ghost_threshold();
+		}
+
+		//=============================================================
+		// load rebalancing (-balance): the unit is a word of 64 rows of
+		// the mapping messages that go through the MATCH kernels, a share
+		// is checked by the helper against the adjacency shipped with it,
+		// and the owner receives its selection words
+
+		static bool is_checked(SIMessage &msg)
+		{
+			SIQuery* query = (SIQuery*)getQuery();
+			return msg.type == IN_MAPPING && !query->isPseudo(msg.curr_u);
+		}
+
+		virtual long long vertex_load(SIVertex* v, vector<SIMessage> &msgs)
+		{
+			if (v->id.vID < 0)
+				return 0;
+			long long words = 0;
+			for (size_t k = 0; k < msgs.size(); k++)
+				if (is_checked(msgs[k]))
+					words += (msgs[k].nrow + 63) / 64;
+			return words;
+		}
+
+		// share: vID, degree, neighbors, then per overlapped message
+		// curr_u, nrow, ncol and the rows
+		virtual void pack_share(SIVertex* v, vector<SIMessage> &msgs,
+			long long first, long long last, vector<int> &share)
+		{
+			SIValue &val = v->value();
+			share.push_back(v->id.vID);
+			share.push_back(val.nbs_vector.size());
+			for (size_t j = 0; j < val.nbs_vector.size(); j++)
+				share.push_back(val.nbs_vector[j].key.vID);
+			long long pos = 0;
+			for (size_t k = 0; k < msgs.size() && pos < last; k++)
+			{
+				SIMessage &msg = msgs[k];
+				if (!is_checked(msg))
+					continue;
+				int nw = (msg.nrow + 63) / 64;
+				long long a = max(first, pos), b = min(last, pos + nw);
+				if (a < b)
+				{
+					int r0 = (a - pos) * 64, r1 = min((int)(b - pos) * 64, msg.nrow);
+					share.push_back(msg.curr_u);
+					share.push_back(r1 - r0);
+					share.push_back(msg.ncol);
+					share.insert(share.end(), msg.mappings + (size_t)r0*msg.ncol,
+						msg.mappings + (size_t)r1*msg.ncol);
+				}
+				pos += nw;
+			}
+		}
+
+		virtual void run_share(vector<int> &share, vector<int> &result)
+		{
+			SIQuery* query = (SIQuery*)getQuery();
+			SIVertex v;
+			v.id.vID = share[0];
+			int degree = share[1];
+			for (int j = 0; j < degree; j++)
+				v.value().nbs_set.insert(share[2 + j]);
+			vector<uint64_t> sel;
+			for (size_t p = 2 + degree; p < share.size(); )
+			{
+				int curr_u = share[p], nrow = share[p+1], ncol = share[p+2];
+				int *rows = &share[p+3];
+				IntSpan sp = query->getBSameLabPos(curr_u);
+				IntSpan np = query->getBNeighborsPos(curr_u);
+				IntSpan lp = query->getSymLessPos(curr_u);
+				IntSpan gp = query->getSymGreaterPos(curr_u);
+				int nw = (nrow + 63) / 64;
+				sel.resize(nw);
+				v.select_rows<-1, -1>(rows, nrow, ncol, 0, nw, sp.begin(), sp.size(),
+					np.begin(), np.size(), lp.begin(), lp.size(),
+					gp.begin(), gp.size(), &sel[0]);
+				for (int w = 0; w < nw; w++)
+				{
+					result.push_back((int)(uint32_t)sel[w]);
+					result.push_back((int)(uint32_t)(sel[w] >> 32));
+				}
+				p += 3 + (size_t)nrow*ncol;
+			}
+		}
+
+		virtual void unpack_share(SIVertex* v, vector<SIMessage> &msgs,
+			long long first, long long last, vector<int> &result)
+		{
+			if (v->pre_sel.empty())
+			{
+				v->pre_sel.resize(msgs.size());
+				v->pre_from.resize(msgs.size());
+			}
+			long long pos = 0;
+			size_t r = 0;
+			for (size_t k = 0; k < msgs.size() && pos < last; k++)
+			{
+				SIMessage &msg = msgs[k];
+				if (!is_checked(msg))
+					continue;
+				int nw = (msg.nrow + 63) / 64;
+				long long a = max(first, pos), b = min(last, pos + nw);
+				if (a < b)
+				{
+					vector<uint64_t> &sel = v->pre_sel[k];
+					if (sel.empty())
+					{
+						sel.resize(nw);
+						v->pre_from[k] = nw;
+					}
+					for (long long w = a - pos; w < b - pos; w++, r += 2)
+						sel[w] = (uint32_t)result[r] | ((uint64_t)(uint32_t)result[r+1] << 32);
+					v->pre_from[k] = min(v->pre_from[k], (int)(a - pos));
+				}
+				pos += nw;
+			}
+		}
+
 		// input line format:
-		// vertexID labelID \t neighbor1 neighbor1ID neighbor2 neighbor2ID ...
+		// vertexID label \t neighbor1 neighbor1Label neighbor2 neighbor2Label ...
+		// labels are arbitrary tokens, see utils/tokenizer.h
+		// thread-safe, called by the loader threads
 		virtual SIVertex* toVertex(char* line)
 		{
-			char * pch;
+			char * pch = skip_blanks(line);
+			if (*pch == '#' || *pch == '\0') return NULL;
 			SIVertex* v = new SIVertex;
 
-			pch = strtok(line, " \t");
-			if (*pch == '#') return NULL;
-			int id = atoi(pch);
+			int id, label;
+			pch = parse_int(pch, id);
 			v->id = SIKey(id, id % _num_workers);
 
-			pch = strtok(NULL, " \t");
-			v->value().label = (int) *pch;
+			pch = parse_label(skip_blanks(pch), v->value().label);
 
-			SIKey key;
-			while ((pch = strtok(NULL, " ")) != NULL)
+			vector<KeyLabel> &nbs = v->value().nbs_vector;
+			while (*(pch = skip_blanks(pch)) != '\0')
 			{
-				id = atoi(pch);
-				key = SIKey(id, id % _num_workers);
-				pch = strtok(NULL, " ");
-				v->value().nbs_vector.push_back(KeyLabel(key, (int) *pch));
-				//v->value().nbs_set.insert(id);
+				pch = parse_int(pch, id);
+				pch = parse_label(skip_blanks(pch), label);
+				nbs.push_back(KeyLabel(SIKey(id, id % _num_workers), label));
 			}
-			size_t sz = v->value().nbs_vector.size();
-			v->value().degree = sz;
+			v->value().degree = nbs.size();
 			return v;
 		}
 
+		// the loaders interned labels into per-worker IDs: count them,
+		// switch to the global dense IDs and group neighbors by label
+		virtual void after_load(vector<SIVertex*> &loaded)
+		{
+			vector<long long> counts(global_label_dict.size(), 0);
+			for (size_t i = 0; i < loaded.size(); i++)
+				counts[loaded[i]->value().label]++;
+			vector<int> trans = sync_label_dict(counts);
+			for (size_t i = 0; i < loaded.size(); i++)
+			{
+				SIValue &val = loaded[i]->value();
+				val.label = trans[val.label];
+				for (size_t j = 0; j < val.nbs_vector.size(); j++)
+					val.nbs_vector[j].label = trans[val.nbs_vector[j].label];
+				val.sortNeighbors();
+			}
+		}
+
 		virtual void toline(SIVertex* v, BufferedWriter & writer)
 		{
 			/*
@@ -764,7 +1242,7 @@ class SIWorker:public Worker<SIVertex, SIQuery, SIAgg>
 						break;
 					case BRANCH_RESULT:
 						if (msg.is_delete)
-							delete msg.branch;
+							delete msg.packed;
 						break;						
 				}				
 			}
@@ -783,12 +1261,16 @@ void pregel_subgraph(const WorkerParams & params)
 	// OFFLINE STAGE
 	MPRINT("");
 	init_timers();
+	set_metrics(params.metrics_path != "");
+	set_compress_mode(params.compress);
+	set_shm(params.shm);
+	set_hier(params.hier);
 	StartTimer(TOTAL_TIMER);
 
 	SIQuery query;
 	worker.setQuery(&query);
 
-	SIAgg agg;
+	SIAgg agg(params.aggsync);
 	worker.setAggregator(&agg);
 
 	// STAGE 1: Load data graph
@@ -796,6 +1278,14 @@ void pregel_subgraph(const WorkerParams & params)
 	ResetTimer(STAGE_TIMER);
 	worker.load_data(params);
 	StopTimer(STAGE_TIMER);
+	if (_my_rank == MASTER_RANK)
+	{
+		cout << "#labels = " << global_label_dict.size();
+		if (!global_label_freq.empty())
+			cout << " (most frequent: " << get_label_name(0) << ", "
+				 << global_label_freq[0] << " vertices)";
+		cout << endl;
+	}
 	PrintTimer("Loading data graph time", STAGE_TIMER)
 
 	// STAGE 2: Preprocessing
@@ -805,6 +1295,19 @@ void pregel_subgraph(const WorkerParams & params)
 	StopTimer(STAGE_TIMER);
 	PrintTimer("Preprocessing time", STAGE_TIMER)
 
+	// STAGE 3: Ghost mirroring
+	if (params.ghost > 0)
+	{
+		MPRINT("Mirroring hub vertices...")
+		ResetTimer(STAGE_TIMER);
+		set_ghost_threshold(params.ghost);
+		int hub_count = all_sum(worker.sync_ghosts(params));
+		StopTimer(STAGE_TIMER);
+		if (_my_rank == MASTER_RANK)
+			cout << "#mirrored hubs = " << hub_count << endl;
+		PrintTimer("Mirroring hub vertices time", STAGE_TIMER)
+	}
+
 	StopTimer(TOTAL_TIMER);
 	PrintTimer("In total, offline time", TOTAL_TIMER)
 
@@ -829,74 +1332,37 @@ void pregel_subgraph(const WorkerParams & params)
 	MPRINT("Building query tree...")
 	ResetTimer(STAGE_TIMER);
 	int depth, bn;
-	worker.build_query_tree(params.order, params.pseudo, depth, bn);
+	worker.build_query_tree(params, depth, bn);
+	SIVertex::select_match_kernels(&query);
 	if (_my_rank == MASTER_RANK)
+	{
 		cout << "depth = " << depth << " max branch number = " << bn << endl;
+		if (params.symmetry > 0)
+			cout << "|Aut| = " << query.aut_size << " symmetry factor = "
+				 << query.sym_factor << endl;
+	}
 	StopTimer(STAGE_TIMER);
 	PrintTimer("Building query tree time", STAGE_TIMER)
 
 	// STAGE 4: Subgraph matching
 	MPRINT("**Subgraph matching**")
 	ResetTimer(STAGE_TIMER);
+	profile_reset();
 	worker.run_type(MATCH, params, depth+1);
 	StopTimer(STAGE_TIMER);
 	PrintTimer("Subgraph matching time", STAGE_TIMER)
 
-/* Timer
-	if (_my_rank == MASTER_RANK)
-	{
-		cout << "[Detailed report]" << endl;
-		auto mat = *((AggMat*)global_agg);
-		cout << "1. Arrange messages: " <<
-			mat[0][0] << " s" << endl;
-		cout << "2. Main Computation: " <<
-			mat[0][1] << " s" << endl;
-		cout << "2.1. Loop through messages and check feasibility: " <<
-			mat[0][2] << " s" << endl;
-		cout << "2.1.1. For branch vertices: " <<
-			mat[2][0] << " s" << endl;		
-		cout << "2.1.2. For leaf vertices: " <<
-			mat[2][1] << " s" << endl;
-		cout << "2.1.3. For not-branch-nor-leaf vertices: " <<
-			mat[2][2] << " s" << endl;
-		cout << "2.2. Continue mapping: " <<
-			mat[1][0] << " s" << endl;	
-		cout << "2.2.1. Construct neighbor map: " <<
-			mat[1][1] << " s" << endl;
-		cout << "2.2.2. Update out messages buffer: " <<
-			mat[1][2] << " s" << endl;
-	}
-*/
+	profile_report("Subgraph matching", ZONE_ARRANGE_MESSAGES, ZONE_ENUM_LEAF);
 
 	// STAGE 5: Subgraph enumeration
 	MPRINT("**Subgraph enumeration**")
 	ResetTimer(STAGE_TIMER);
+	profile_reset();
 	worker.run_type(ENUMERATE, params, bn+1);
 	StopTimer(STAGE_TIMER);
 	PrintTimer("Subgraph enumeration time", STAGE_TIMER)
 
-/* Timer
-	if (_my_rank == MASTER_RANK)
-	{
-		cout << "[Detailed report]" << endl;
-		auto mat = *((AggMat*)global_agg);
-		cout << "a) For leaf vertices: " <<
-			mat[2][1] << " s" << endl;
-		cout << "b) For dummy vertices: " <<
-			mat[0][1] << " s" << endl;
-		cout << "==build_branch==" << endl;
-		cout << "1. Organize branches: " <<
-			mat[0][2] << " s" << endl;	
-		cout << "2. Enumerate trees: " <<
-			mat[1][0] << " s" << endl;		
-		cout << "3. Send to dummies or expand: " <<
-			mat[1][1] << " s" << endl;
-		cout << "3.1. Send to dummies: " <<
-			mat[2][0] << " s" << endl;
-		cout << "3.2. Expand: " <<
-			mat[1][2] << " s" << endl;
-	}
-*/
+	profile_report("Subgraph enumeration", ZONE_ENUM_LEAF, N_ZONES);
 
 	StopTimer(COMPUTE_TIMER);
 	//=============== The most important timer stops here!!! =================
@@ -914,10 +1380,17 @@ void pregel_subgraph(const WorkerParams & params)
 	if (_my_rank == MASTER_RANK)
 	{
 		cout << "================ Final Report ===============" << endl;
-		cout << "Mapping count: " <<
-				(long) (*((AggMat*)global_agg))[0][0] << endl;
+		// the count is of the embeddings left by symmetry breaking
+		long count = (long) (*((AggMat*)global_agg))[0][0] * query.sym_factor;
+		if (params.symmetry == 2)
+			cout << "Subgraph count: " << count / query.aut_size << endl;
+		else
+			cout << "Mapping count: " << count << endl;
 	}
 
 	PrintTimer("COMPUTE Time", COMPUTE_TIMER);
 
+	if (params.metrics_path != "")
+		worker.dump_metrics(params.metrics_path);
+
 }
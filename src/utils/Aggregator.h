@@ -5,6 +5,13 @@
 
 #define AGGSWITCH 10485760
 
+//how Worker::agg_sync reduces the partials of the workers
+enum AGG_SYNC_MODES {
+    AGG_GATHER = 0, //MASTER_RANK gathers them all and calls stepFinal() on each
+    AGG_TREE = 1, //binomial tree, needs stepFinal() to merge into finishPartial()
+    AGG_POD = 2 //fixed-size POD partial, a single MPI_Allreduce
+};
+
 template <class PartialT, class FinalT>
 class Aggregator {
 public:
@@ -15,6 +22,29 @@ public:
     virtual PartialT* finishPartial() = 0;
     virtual void stepFinal(PartialT* part) = 0;
     virtual FinalT* finishFinal() = 0;
+
+    virtual int sync_mode()
+    {
+        return AGG_GATHER;
+    }
+
+    //AGG_POD only: the partial is pod_size() bytes, to_pod() writes
+    //finishPartial() to buf, pod_combine() adds in to inout like
+    //stepFinal(), and from_pod() loads the partials of all workers
+    //combined, so that finishFinal() gives the result
+    virtual int pod_size()
+    {
+        return 0;
+    }
+    virtual void to_pod(char* buf)
+    {
+    }
+    virtual void pod_combine(const char* in, char* inout)
+    {
+    }
+    virtual void from_pod(const char* buf)
+    {
+    }
 };
 
 class DummyAgg : public Aggregator<char, char> {
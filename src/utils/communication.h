@@ -5,37 +5,64 @@
 
 #include <mpi.h>
 #include "time.h"
+#include "transport.h"
 #include "serialization.h"
 #include "global.h"
+#include "metrics.h"
+#include "compress.h"
 
 //============================================
 //Allreduce
 int all_sum(int my_copy)
 {
-    int tmp;
-    MPI_Allreduce(&my_copy, &tmp, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-    return tmp;
+    get_transport().allreduce(&my_copy, 1, RED_INT, RED_SUM);
+    return my_copy;
 }
 
 long long master_sum_LL(long long my_copy)
 {
-    long long tmp = 0;
-    MPI_Reduce(&my_copy, &tmp, 1, MPI_LONG_LONG_INT, MPI_SUM, MASTER_RANK, MPI_COMM_WORLD);
-    return tmp;
+    get_transport().reduce(&my_copy, 1, RED_LL, RED_SUM, MASTER_RANK);
+    return _my_rank == MASTER_RANK ? my_copy : 0;
 }
 
 long long all_sum_LL(long long my_copy)
 {
-    long long tmp = 0;
-    MPI_Allreduce(&my_copy, &tmp, 1, MPI_LONG_LONG_INT, MPI_SUM, MPI_COMM_WORLD);
-    return tmp;
+    get_transport().allreduce(&my_copy, 1, RED_LL, RED_SUM);
+    return my_copy;
 }
 
 char all_bor(char my_copy)
 {
-    char tmp;
-    MPI_Allreduce(&my_copy, &tmp, 1, MPI_BYTE, MPI_BOR, MPI_COMM_WORLD);
-    return tmp;
+    get_transport().allreduce(&my_copy, 1, RED_CHAR, RED_BOR);
+    return my_copy;
+}
+
+//control plane of a superstep: the counters and flags of every worker
+//that decide whether to go on, summed by a single allreduce (a flag is
+//set on some worker iff its sum is > 0)
+struct StepControl {
+    long long active; //#active vertices after the message exchange
+    long long has_msg; //msgs or vertices were sent
+    long long terminate; //forceTerminate() was called
+    long long msg_num;
+    long long vadd_num;
+    long long bytes; //bytes sent
+};
+
+void all_sum_control(StepControl& c)
+{
+    get_transport().allreduce(&c, sizeof(StepControl) / sizeof(long long), RED_LL, RED_SUM);
+}
+
+//allreduce of a POD of size bytes, op(in, inout, len, type) combines len
+//of them and must be associative and commutative
+void all_reduce_pod(void* buf, int size, MPI_User_function* op)
+{
+    StartTimer(COMMUNICATION_TIMER);
+    StartTimer(TRANSFER_TIMER);
+    get_transport().allreduce_pod(buf, size, op);
+    StopTimer(TRANSFER_TIMER);
+    StopTimer(COMMUNICATION_TIMER);
 }
 
 /*
@@ -47,40 +74,84 @@ bool all_lor(bool my_copy){
 */
 
 //============================================
-//char-level send/recv
-void pregel_send(void* buf, int size, int dst)
+//char-level send/recv, see transport.h
+void pregel_send(void* buf, size_t size, int dst)
+{
+    get_transport().send(buf, size, dst);
+}
+
+void pregel_recv(void* buf, size_t size, int src)
 {
-    MPI_Send(buf, size, MPI_CHAR, dst, 0, MPI_COMM_WORLD);
+    get_transport().recv(buf, size, src);
 }
 
-void pregel_recv(void* buf, int size, int src)
+//size bytes from MASTER_RANK
+void pregel_bcast(void* buf, size_t size)
 {
-    MPI_Recv(buf, size, MPI_CHAR, src, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    get_transport().bcast(buf, size, MASTER_RANK);
 }
 
 //============================================
 //binstream-level send/recv
+//A buffer goes as a header {raw size, wire size} then its wire bytes,
+//LZ-compressed if wire size < raw size (see compress.h)
+//m is left empty, its buffer is handed over to the transport
 void send_ibinstream(ibinstream& m, int dst)
 {
     size_t size = m.size();
+    char* wire = m.get_buf();
+    size_t hdr[2] = { size, size };
+    bool compressed = false;
+    if (should_compress(dst, size)) {
+        double t = get_current_time();
+        StartTimer(COMPRESS_TIMER);
+        wire = new char[lz_bound(size)];
+        hdr[1] = lz_compress(m.get_buf(), size, wire);
+        StopTimer(COMPRESS_TIMER);
+        record_compression(dst, size, hdr[1], get_current_time() - t);
+        compressed = hdr[1] < size;
+        if (!compressed) { //incompressible, send it raw
+            delete[] wire;
+            wire = m.get_buf();
+            hdr[1] = size;
+        }
+    }
+    count_bytes_sent(dst, hdr[1], size);
     //cout << "**From " << _my_rank << " to " << dst
     	 //<< ". Send size: " << size << endl;
-    pregel_send(&size, sizeof(size_t), dst);
-    pregel_send(m.get_buf(), m.size(), dst);
+    pregel_send(hdr, sizeof(hdr), dst);
+    //the wire buffer is handed over, the thread transport does not copy it
+    get_transport().send_owned(compressed ? wire : m.release(), hdr[1], dst);
     //cout << "**Send OK." << endl;
 }
 
+//receives the buffer of a send_ibinstream, the caller owns it
+char* recv_buffer(int src, size_t& size)
+{
+    size_t hdr[2];
+    pregel_recv(hdr, sizeof(hdr), src);
+    size = hdr[0];
+    double t = get_current_time();
+    char* wire = get_transport().recv_new(hdr[1], src);
+    record_transfer(src, hdr[1], get_current_time() - t);
+    if (hdr[1] == size)
+        return wire;
+    char* buf = new char[size];
+    StartTimer(COMPRESS_TIMER);
+    bool ok = lz_decompress(wire, hdr[1], buf, size);
+    StopTimer(COMPRESS_TIMER);
+    delete[] wire;
+    if (!ok) {
+        fprintf(stderr, "Corrupt compressed buffer from worker %d!\n", src);
+        exit(-1);
+    }
+    return buf;
+}
+
 obinstream recv_obinstream(int src)
 {
     size_t size;
-    pregel_recv(&size, sizeof(size_t), src);
-    //cout << "**From " << src << " to " << _my_rank
-    	 //<< "**1Recv size: " << size << endl;
-    char* buf = new char[size];
-    //cout << "**From " << src << " to " << _my_rank
-       	 //<< "**2Recv size: " << size << endl;
-    pregel_recv(buf, size, src);
-    //cout << "**Recv OK. " << endl;
+    char* buf = recv_buffer(src, size);
     return obinstream(buf, size);
 }
 
@@ -103,8 +174,333 @@ T recv_data(int src)
     return data;
 }
 
+//============================================
+//node-local transport
+//The buffers between the workers of a host go through an MPI-3 shared
+//memory window instead of point-to-point messages: a worker copies them
+//into its own segment of the window, and the receivers deserialize them
+//in place from there. Turned off by -shm off.
+//With -hier on, the buffers to the other hosts take the same way: the
+//leader of every host (its worker of node rank 0) collects from the
+//segments of its workers all the buffers to another host, sends them to
+//the leader of that host in one message, and writes what it receives in
+//its inbox window, where its workers read them in place. Hosts then
+//exchange #hosts^2 large messages instead of #workers^2 small ones.
+//Building with -DNODE_SIZE=k fakes hosts of k consecutive workers, to
+//try it on one machine.
+//MPI transport only: the workers of the thread transport already share
+//their buffers.
+WORKER_LOCAL(bool, global_shm_on, true);
+WORKER_LOCAL(bool, global_hier_on, false);
+WORKER_LOCAL(MPI_Comm, _node_comm, MPI_COMM_NULL); //the workers of this host
+WORKER_LOCAL(int, _node_size, 1);
+WORKER_LOCAL(vector<int>, _node_rank); //worker -> rank in _node_comm, -1 on another host
+WORKER_LOCAL(vector<int>, _node_members); //rank in _node_comm -> worker
+WORKER_LOCAL(vector<int>, _node_id); //worker -> its host, 0, 1, ...
+WORKER_LOCAL(vector<int>, _leaders); //host -> its leader
+WORKER_LOCAL(bool, _hier, false); //-hier on, and more than one host
+
+struct ShmWindow {
+    MPI_Win win;
+    size_t capacity; //of the own segment
+    vector<char*> segments; //rank in _node_comm -> its segment
+
+    ShmWindow()
+        : win(MPI_WIN_NULL)
+        , capacity(0)
+    {
+    }
+
+    char* own()
+    {
+        return segments[_node_rank[_my_rank]];
+    }
+};
+
+WORKER_LOCAL(ShmWindow, _shm_out); //the buffers sent by every worker of the host
+WORKER_LOCAL(ShmWindow, _shm_inbox); //-hier: what the leader received for the host
+
+inline void set_shm(bool on)
+{
+    global_shm_on = on;
+}
+
+inline void set_hier(bool on)
+{
+    global_hier_on = on;
+}
+
+//internal use only! splits MPI_COMM_WORLD by host
+void init_node_comm()
+{
+#ifdef NODE_SIZE
+    MPI_Comm_split(MPI_COMM_WORLD, _my_rank / NODE_SIZE, _my_rank, &_node_comm);
+#else
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, _my_rank,
+        MPI_INFO_NULL, &_node_comm);
+#endif
+    MPI_Comm_size(_node_comm, &_node_size);
+    MPI_Group world, node;
+    MPI_Comm_group(MPI_COMM_WORLD, &world);
+    MPI_Comm_group(_node_comm, &node);
+    vector<int> ranks(_num_workers);
+    for (int i = 0; i < _num_workers; i++)
+        ranks[i] = i;
+    _node_rank.resize(_num_workers);
+    MPI_Group_translate_ranks(world, _num_workers, &ranks[0], node, &_node_rank[0]);
+    _node_members.resize(_node_size);
+    for (int i = 0; i < _num_workers; i++) {
+        if (_node_rank[i] == MPI_UNDEFINED)
+            _node_rank[i] = -1;
+        else
+            _node_members[_node_rank[i]] = i;
+    }
+    MPI_Group_free(&world);
+    MPI_Group_free(&node);
+    //hosts, numbered in the order of their leaders
+    vector<int> leader_of(_num_workers);
+    MPI_Allgather(&_node_members[0], 1, MPI_INT, &leader_of[0], 1, MPI_INT, MPI_COMM_WORLD);
+    _node_id.resize(_num_workers);
+    _leaders.clear();
+    for (int i = 0; i < _num_workers; i++)
+        if (leader_of[i] == i)
+            _leaders.push_back(i);
+    for (int i = 0; i < _num_workers; i++)
+        _node_id[i] = lower_bound(_leaders.begin(), _leaders.end(), leader_of[i]) - _leaders.begin();
+    _hier = global_hier_on && _leaders.size() > 1;
+}
+
+//whether the shared windows are used, collective (the first call splits
+//MPI_COMM_WORLD by host)
+bool shm_ready()
+{
+    if (!global_shm_on || _num_workers == 1 || get_transport().in_process())
+        return false;
+    if (_node_comm == MPI_COMM_NULL)
+        init_node_comm();
+    return _node_size > 1 || _hier;
+}
+
+//makes the own segment of w at least need bytes, collective on the host;
+//it also waits until the others are done reading the last exchange
+void shm_reserve(ShmWindow& w, size_t need)
+{
+    int grow = need > w.capacity;
+    MPI_Allreduce(MPI_IN_PLACE, &grow, 1, MPI_INT, MPI_MAX, _node_comm);
+    if (!grow)
+        return;
+    if (w.win != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(w.win);
+        MPI_Win_free(&w.win);
+    }
+    w.capacity = max(need, 2 * w.capacity);
+    char* base;
+    MPI_Win_allocate_shared(w.capacity, 1, MPI_INFO_NULL, _node_comm, &base, &w.win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, w.win);
+    w.segments.resize(_node_size);
+    for (int i = 0; i < _node_size; i++) {
+        MPI_Aint size;
+        int disp;
+        MPI_Win_shared_query(w.win, i, &size, &disp, &w.segments[i]);
+    }
+}
+
+//collective on the host
+void shm_free(ShmWindow& w)
+{
+    if (w.win != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(w.win);
+        MPI_Win_free(&w.win);
+        w.capacity = 0;
+    }
+}
+
+//collective on the host
+void shm_free()
+{
+    shm_free(_shm_out);
+    shm_free(_shm_inbox);
+    if (_node_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&_node_comm);
+}
+
+//-hier, collective on the host, after the outgoing tables and buffers of
+//the workers are in their segments of _shm_out (the table, 3 long longs
+//{how, offset, size} per worker, first): the leader relays the buffers
+//to the other hosts (how = 3), and fills _shm_inbox with the index
+//(node rank of the receiver, sender) -> offset, then the buffers
+void leader_relay()
+{
+    int np = _num_workers;
+    int nn = _leaders.size();
+    int k = _node_id[_my_rank];
+    ibinstream box; //the inbox, built by the leader
+    if (_node_rank[_my_rank] == 0) {
+        //one message per host: {sender, receiver, size, bytes} records
+        vector<ibinstream> msgs(nn);
+        StartTimer(SERIALIZATION_TIMER);
+        for (int l = 0; l < _node_size; l++) {
+            char* seg = _shm_out.segments[l];
+            long long* table = (long long*)seg;
+            for (int d = 0; d < np; d++)
+                if (table[3 * d] == 3) {
+                    ibinstream& m = msgs[_node_id[d]];
+                    m << _node_members[l] << d << (size_t)table[3 * d + 2];
+                    m.raw_bytes(seg + table[3 * d + 1], table[3 * d + 2]);
+                }
+        }
+        vector<long long> index((size_t)_node_size * np, 0);
+        box.raw_bytes(&index[0], index.size() * sizeof(long long));
+        StopTimer(SERIALIZATION_TIMER);
+        //the leaders exchange in rounds, as in sparse_all_to_all
+        for (int i = 0; i < nn; i++) {
+            int partner = (i - k + nn) % nn;
+            if (partner == k)
+                continue;
+            char* buf = NULL;
+            size_t size = 0;
+            StartTimer(TRANSFER_TIMER);
+            if (k > partner)
+                buf = recv_buffer(_leaders[partner], size);
+            send_ibinstream(msgs[partner], _leaders[partner]);
+            if (k < partner)
+                buf = recv_buffer(_leaders[partner], size);
+            StopTimer(TRANSFER_TIMER);
+            StartTimer(SERIALIZATION_TIMER);
+            obinstream um(buf, size); //deletes buf
+            for (size_t pos = 0; pos < size;) {
+                int src, dst;
+                size_t n;
+                um >> src >> dst >> n;
+                long long offset = box.size();
+                memcpy(box.get_buf() + ((size_t)_node_rank[dst] * np + src) * sizeof(long long),
+                    &offset, sizeof(long long));
+                box.raw_bytes(um.raw_bytes(n), n);
+                pos += 2 * sizeof(int) + sizeof(size_t) + n;
+            }
+            StopTimer(SERIALIZATION_TIMER);
+        }
+    }
+    StartTimer(TRANSFER_TIMER);
+    shm_reserve(_shm_inbox, box.size());
+    if (box.size() > 0)
+        memcpy(_shm_inbox.own(), box.get_buf(), box.size());
+    MPI_Win_sync(_shm_inbox.win);
+    MPI_Barrier(_node_comm);
+    MPI_Win_sync(_shm_inbox.win);
+    StopTimer(TRANSFER_TIMER);
+}
+
 //============================================
 //all-to-all
+//Sparse exchange: the ranks first agree on the non-empty pairs with one
+//alltoall of {how, offset, size} per pair, then only the pairs with
+//data talk. The data for the workers of the same host is packed up front
+//into the shared segment of the sender (how = 2, at offset, of size
+//bytes) and read in place by the receiver; with -hier, so is the data
+//for the other hosts, relayed by the leaders (how = 3); the other pairs
+//(how = 1) talk in rounds where every rank has a single partner, the
+//lower rank of a pair sending first. pack(partner, m) serializes the
+//data to partner, unpack(partner, um, received) restores the data
+//received from partner (received = false if there is none).
+template <class Pack, class Unpack>
+void sparse_all_to_all(vector<int>& has_data, Pack pack, Unpack unpack)
+{
+    int np = get_num_workers();
+    int me = get_worker_id();
+    bool shm = shm_ready();
+    vector<long long> out(3 * np, 0), in(3 * np, 0);
+    size_t head = _hier ? 3 * np * sizeof(long long) : 0; //the table, for leader_relay
+    ibinstream lm; //to the workers of this host, and with -hier, of the others
+    for (int p = 0; p < np; p++) {
+        if (!has_data[p] || p == me)
+            continue;
+        if (!shm || (_node_rank[p] < 0 && !_hier)) {
+            out[3 * p] = 1;
+            continue;
+        }
+        StartTimer(SERIALIZATION_TIMER);
+        size_t offset = lm.size();
+        pack(p, lm);
+        StopTimer(SERIALIZATION_TIMER);
+        out[3 * p] = _node_rank[p] >= 0 ? 2 : 3;
+        out[3 * p + 1] = head + offset;
+        out[3 * p + 2] = lm.size() - offset;
+        if (out[3 * p] == 2) //how = 3 is counted by the leader
+            count_bytes_sent(p, lm.size() - offset, lm.size() - offset);
+    }
+    StartTimer(TRANSFER_TIMER);
+    if (shm) {
+        shm_reserve(_shm_out, head + lm.size());
+        if (head > 0)
+            memcpy(_shm_out.own(), &out[0], head);
+        if (lm.size() > 0)
+            memcpy(_shm_out.own() + head, lm.get_buf(), lm.size());
+        MPI_Win_sync(_shm_out.win);
+    }
+    get_transport().alltoall(&out[0], &in[0], 3 * sizeof(long long));
+    if (shm)
+        MPI_Win_sync(_shm_out.win);
+    StopTimer(TRANSFER_TIMER);
+    for (int p = 0; p < np; p++) {
+        if (out[3 * p] != 2 && in[3 * p] != 2)
+            continue;
+        StartTimer(SERIALIZATION_TIMER);
+        char* buf = NULL;
+        if (in[3 * p] == 2)
+            buf = _shm_out.segments[_node_rank[p]] + in[3 * p + 1];
+        obinstream um(buf, in[3 * p + 2], 0, false);
+        unpack(p, um, in[3 * p] == 2);
+        StopTimer(SERIALIZATION_TIMER);
+    }
+    if (_hier && shm) {
+        leader_relay();
+        long long* index = (long long*)_shm_inbox.segments[0] + (size_t)_node_rank[me] * np;
+        for (int p = 0; p < np; p++) {
+            if (out[3 * p] != 3 && in[3 * p] != 3)
+                continue;
+            StartTimer(SERIALIZATION_TIMER);
+            char* buf = NULL;
+            if (in[3 * p] == 3)
+                buf = _shm_inbox.segments[0] + index[p];
+            obinstream um(buf, in[3 * p + 2], 0, false);
+            unpack(p, um, in[3 * p] == 3);
+            StopTimer(SERIALIZATION_TIMER);
+        }
+    }
+    for (int i = 0; i < np; i++) {
+        int partner = (i - me + np) % np;
+        bool sends = out[3 * partner] == 1, gets = in[3 * partner] == 1;
+        if (me == partner || (!sends && !gets))
+            continue;
+        char* buf = NULL;
+        size_t size = 0;
+        if (me > partner && gets) {
+            StartTimer(TRANSFER_TIMER);
+            buf = recv_buffer(partner, size);
+            StopTimer(TRANSFER_TIMER);
+        }
+        if (sends) {
+            StartTimer(SERIALIZATION_TIMER);
+            ibinstream m;
+            pack(partner, m);
+            StopTimer(SERIALIZATION_TIMER);
+            StartTimer(TRANSFER_TIMER);
+            send_ibinstream(m, partner);
+            StopTimer(TRANSFER_TIMER);
+        }
+        if (me < partner && gets) {
+            StartTimer(TRANSFER_TIMER);
+            buf = recv_buffer(partner, size);
+            StopTimer(TRANSFER_TIMER);
+        }
+        StartTimer(SERIALIZATION_TIMER);
+        obinstream um(buf, size); //deletes buf
+        unpack(partner, um, gets);
+        StopTimer(SERIALIZATION_TIMER);
+    }
+}
+
 template <class T>
 void all_to_all(std::vector<T>& to_exchange)
 {
@@ -112,46 +508,19 @@ void all_to_all(std::vector<T>& to_exchange)
     //for each to_exchange[i]
     //        send out *to_exchange[i] to i
     //        save received data in *to_exchange[i]
-    int np = get_num_workers();
-    int me = get_worker_id();
-    for (int i = 0; i < np; i++) {
-        int partner = (i - me + np) % np;
-        if (me != partner) {
-            if (me < partner) {
-                StartTimer(SERIALIZATION_TIMER);
-                //send
-                ibinstream m;
-                m << to_exchange[partner];
-                StopTimer(SERIALIZATION_TIMER);
-                StartTimer(TRANSFER_TIMER);
-                send_ibinstream(m, partner);
-                StopTimer(TRANSFER_TIMER);
-                //receive
-                StartTimer(TRANSFER_TIMER);
-                obinstream um = recv_obinstream(partner);
-                StopTimer(TRANSFER_TIMER);
-                StartTimer(SERIALIZATION_TIMER);
+    vector<int> has_data(get_num_workers());
+    for (size_t i = 0; i < has_data.size(); i++)
+        has_data[i] = !to_exchange[i].empty();
+    sparse_all_to_all(has_data,
+        [&](int partner, ibinstream& m) {
+            m << to_exchange[partner];
+        },
+        [&](int partner, obinstream& um, bool received) {
+            if (received)
                 um >> to_exchange[partner];
-                StopTimer(SERIALIZATION_TIMER);
-            } else {
-                StartTimer(TRANSFER_TIMER);
-                //receive
-                obinstream um = recv_obinstream(partner);
-                StopTimer(TRANSFER_TIMER);
-                StartTimer(SERIALIZATION_TIMER);
-                T received;
-                um >> received;
-                //send
-                ibinstream m;
-                m << to_exchange[partner];
-                StopTimer(SERIALIZATION_TIMER);
-                StartTimer(TRANSFER_TIMER);
-                send_ibinstream(m, partner);
-                StopTimer(TRANSFER_TIMER);
-                to_exchange[partner] = received;
-            }
-        }
-    }
+            else
+                to_exchange[partner].clear();
+        });
     StopTimer(COMMUNICATION_TIMER);
 }
 
@@ -163,50 +532,23 @@ void all_to_all_cat(std::vector<T>& to_exchange1, std::vector<T1>& to_exchange2)
     //for each to_exchange[i]
     //        send out *to_exchange[i] to i
     //        save received data in *to_exchange[i]
-    int np = get_num_workers();
-    int me = get_worker_id();
-    for (int i = 0; i < np; i++) {
-        int partner = (i - me + np) % np;
-        if (me < partner) {
-            StartTimer(SERIALIZATION_TIMER);
-            //send
-            ibinstream m;
-            m << to_exchange1[partner];
-            m << to_exchange2[partner];
-            StopTimer(SERIALIZATION_TIMER);
-            StartTimer(TRANSFER_TIMER);
-            send_ibinstream(m, partner);
-            StopTimer(TRANSFER_TIMER);
-            //receive
-            StartTimer(TRANSFER_TIMER);
-            obinstream um = recv_obinstream(partner);
-            StopTimer(TRANSFER_TIMER);
-            StartTimer(SERIALIZATION_TIMER);
-            um >> to_exchange1[partner];
-            um >> to_exchange2[partner];
-            StopTimer(SERIALIZATION_TIMER);
-        } else if (me > partner) {
-            StartTimer(TRANSFER_TIMER);
-            //receive
-            obinstream um = recv_obinstream(partner);
-            StopTimer(TRANSFER_TIMER);
-            StartTimer(SERIALIZATION_TIMER);
-            T received1;
-            T1 received2;
-            um >> received1;
-            um >> received2;
-            //send
-            ibinstream m;
+    vector<int> has_data(get_num_workers());
+    for (size_t i = 0; i < has_data.size(); i++)
+        has_data[i] = !to_exchange1[i].empty() || !to_exchange2[i].empty();
+    sparse_all_to_all(has_data,
+        [&](int partner, ibinstream& m) {
             m << to_exchange1[partner];
             m << to_exchange2[partner];
-            StopTimer(SERIALIZATION_TIMER);
-            StartTimer(TRANSFER_TIMER);
-            send_ibinstream(m, partner);
-            StopTimer(TRANSFER_TIMER);
-            to_exchange1[partner] = received1;
-            to_exchange2[partner] = received2;
-        } 
-    }
+        },
+        [&](int partner, obinstream& um, bool received) {
+            if (received) {
+                um >> to_exchange1[partner];
+                um >> to_exchange2[partner];
+            } else {
+                to_exchange1[partner].clear();
+                to_exchange2[partner].clear();
+            }
+        });
     StopTimer(COMMUNICATION_TIMER);
 }
 
@@ -217,58 +559,27 @@ void all_to_all_cat(std::vector<T>& to_exchange1, std::vector<T1>& to_exchange2,
     //for each to_exchange[i]
     //        send out *to_exchange[i] to i
     //        save received data in *to_exchange[i]
-    int np = get_num_workers();
-    int me = get_worker_id();
-    for (int i = 0; i < np; i++) {
-        int partner = (i - me + np) % np;
-        if (me != partner) {
-            if (me < partner) {
-                StartTimer(SERIALIZATION_TIMER);
-                //send
-                ibinstream m;
-                m << to_exchange1[partner];
-                m << to_exchange2[partner];
-                m << to_exchange3[partner];
-                StopTimer(SERIALIZATION_TIMER);
-                StartTimer(TRANSFER_TIMER);
-                send_ibinstream(m, partner);
-                StopTimer(TRANSFER_TIMER);
-                //receive
-                StartTimer(TRANSFER_TIMER);
-                obinstream um = recv_obinstream(partner);
-                StopTimer(TRANSFER_TIMER);
-                StartTimer(SERIALIZATION_TIMER);
+    vector<int> has_data(get_num_workers());
+    for (size_t i = 0; i < has_data.size(); i++)
+        has_data[i] = !to_exchange1[i].empty() || !to_exchange2[i].empty()
+            || !to_exchange3[i].empty();
+    sparse_all_to_all(has_data,
+        [&](int partner, ibinstream& m) {
+            m << to_exchange1[partner];
+            m << to_exchange2[partner];
+            m << to_exchange3[partner];
+        },
+        [&](int partner, obinstream& um, bool received) {
+            if (received) {
                 um >> to_exchange1[partner];
                 um >> to_exchange2[partner];
                 um >> to_exchange3[partner];
-                StopTimer(SERIALIZATION_TIMER);
             } else {
-                StartTimer(TRANSFER_TIMER);
-                //receive
-                obinstream um = recv_obinstream(partner);
-                StopTimer(TRANSFER_TIMER);
-                StartTimer(SERIALIZATION_TIMER);
-                T received1;
-                T1 received2;
-                T2 received3;
-                um >> received1;
-                um >> received2;
-                um >> received3;
-                //send
-                ibinstream m;
-                m << to_exchange1[partner];
-                m << to_exchange2[partner];
-                m << to_exchange3[partner];
-                StopTimer(SERIALIZATION_TIMER);
-                StartTimer(TRANSFER_TIMER);
-                send_ibinstream(m, partner);
-                StopTimer(TRANSFER_TIMER);
-                to_exchange1[partner] = received1;
-                to_exchange2[partner] = received2;
-                to_exchange3[partner] = received3;
+                to_exchange1[partner].clear();
+                to_exchange2[partner].clear();
+                to_exchange3[partner].clear();
             }
-        }
-    }
+        });
     StopTimer(COMMUNICATION_TIMER);
 }
 
@@ -279,46 +590,19 @@ void all_to_all(vector<T>& to_send, vector<T1>& to_get)
     //for each to_exchange[i]
     //        send out *to_exchange[i] to i
     //        save received data in *to_exchange[i]
-    int np = get_num_workers();
-    int me = get_worker_id();
-    for (int i = 0; i < np; i++) {
-        int partner = (i - me + np) % np;
-        if (me != partner) {
-            if (me < partner) {
-                StartTimer(SERIALIZATION_TIMER);
-                //send
-                ibinstream m;
-                m << to_send[partner];
-                StopTimer(SERIALIZATION_TIMER);
-                StartTimer(TRANSFER_TIMER);
-                send_ibinstream(m, partner);
-                StopTimer(TRANSFER_TIMER);
-                //receive
-                StartTimer(TRANSFER_TIMER);
-                obinstream um = recv_obinstream(partner);
-                StopTimer(TRANSFER_TIMER);
-                StartTimer(SERIALIZATION_TIMER);
+    vector<int> has_data(get_num_workers());
+    for (size_t i = 0; i < has_data.size(); i++)
+        has_data[i] = !to_send[i].empty();
+    sparse_all_to_all(has_data,
+        [&](int partner, ibinstream& m) {
+            m << to_send[partner];
+        },
+        [&](int partner, obinstream& um, bool received) {
+            if (received)
                 um >> to_get[partner];
-                StopTimer(SERIALIZATION_TIMER);
-            } else {
-                StartTimer(TRANSFER_TIMER);
-                //receive
-                obinstream um = recv_obinstream(partner);
-                StopTimer(TRANSFER_TIMER);
-                StartTimer(SERIALIZATION_TIMER);
-                T1 received;
-                um >> received;
-                //send
-                ibinstream m;
-                m << to_send[partner];
-                StopTimer(SERIALIZATION_TIMER);
-                StartTimer(TRANSFER_TIMER);
-                send_ibinstream(m, partner);
-                StopTimer(TRANSFER_TIMER);
-                to_get[partner] = received;
-            }
-        }
-    }
+            else
+                to_get[partner].clear();
+        });
     StopTimer(COMMUNICATION_TIMER);
 }
 
@@ -347,17 +631,17 @@ void masterScatter(vector<T>& to_send)
     StopTimer(SERIALIZATION_TIMER);
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Scatter(sendcounts, 1, MPI_INT, &recvcount, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().scatter(sendcounts, &recvcount, sizeof(int), MASTER_RANK);
     StopTimer(TRANSFER_TIMER);
 
     for (int i = 0; i < _num_workers; i++) {
         sendoffset[i] = (i == 0 ? 0 : sendoffset[i - 1] + sendcounts[i - 1]);
     }
     char* sendbuf = m.get_buf(); //ibinstream will delete it
-    char* recvbuf;
+    char* recvbuf = NULL; //the root receives nothing
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Scatterv(sendbuf, sendcounts, sendoffset, MPI_CHAR, recvbuf, recvcount, MPI_CHAR, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().scatterv(sendbuf, sendcounts, sendoffset, recvbuf, recvcount, MASTER_RANK);
     StopTimer(TRANSFER_TIMER);
 
     delete[] sendcounts;
@@ -369,17 +653,17 @@ template <class T>
 void slaveScatter(T& to_get)
 { //scatter
     StartTimer(COMMUNICATION_TIMER);
-    int* sendcounts;
+    int* sendcounts = NULL; //only used at the root
     int recvcount;
-    int* sendoffset;
+    int* sendoffset = NULL;
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Scatter(sendcounts, 1, MPI_INT, &recvcount, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().scatter(sendcounts, &recvcount, sizeof(int), MASTER_RANK);
 
-    char* sendbuf;
+    char* sendbuf = NULL;
     char* recvbuf = new char[recvcount]; //obinstream will delete it
 
-    MPI_Scatterv(sendbuf, sendcounts, sendoffset, MPI_CHAR, recvbuf, recvcount, MPI_CHAR, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().scatterv(sendbuf, sendcounts, sendoffset, recvbuf, recvcount, MASTER_RANK);
     StopTimer(TRANSFER_TIMER);
 
     StartTimer(SERIALIZATION_TIMER);
@@ -400,19 +684,19 @@ void masterGather(vector<T>& to_get)
     int* recvoffset = new int[_num_workers];
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Gather(&sendcount, 1, MPI_INT, recvcounts, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().gather(&sendcount, recvcounts, sizeof(int), MASTER_RANK);
     StopTimer(TRANSFER_TIMER);
 
     for (int i = 0; i < _num_workers; i++) {
         recvoffset[i] = (i == 0 ? 0 : recvoffset[i - 1] + recvcounts[i - 1]);
     }
 
-    char* sendbuf;
+    char* sendbuf = NULL; //the root sends nothing
     int recv_tot = recvoffset[_num_workers - 1] + recvcounts[_num_workers - 1];
     char* recvbuf = new char[recv_tot]; //obinstream will delete it
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Gatherv(sendbuf, sendcount, MPI_CHAR, recvbuf, recvcounts, recvoffset, MPI_CHAR, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().gatherv(sendbuf, sendcount, recvbuf, recvcounts, recvoffset, MASTER_RANK);
     StopTimer(TRANSFER_TIMER);
 
     StartTimer(SERIALIZATION_TIMER);
@@ -433,8 +717,8 @@ void slaveGather(T& to_send)
 { //gather
     StartTimer(COMMUNICATION_TIMER);
     int sendcount;
-    int* recvcounts;
-    int* recvoffset;
+    int* recvcounts = NULL; //only used at the root
+    int* recvoffset = NULL;
 
     StartTimer(SERIALIZATION_TIMER);
     ibinstream m;
@@ -443,18 +727,53 @@ void slaveGather(T& to_send)
     StopTimer(SERIALIZATION_TIMER);
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Gather(&sendcount, 1, MPI_INT, recvcounts, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().gather(&sendcount, recvcounts, sizeof(int), MASTER_RANK);
     StopTimer(TRANSFER_TIMER);
 
     char* sendbuf = m.get_buf(); //ibinstream will delete it
-    char* recvbuf;
+    char* recvbuf = NULL; //only used at the root
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Gatherv(sendbuf, sendcount, MPI_CHAR, recvbuf, recvcounts, recvoffset, MPI_CHAR, MASTER_RANK, MPI_COMM_WORLD);
+    get_transport().gatherv(sendbuf, sendcount, recvbuf, recvcounts, recvoffset, MASTER_RANK);
     StopTimer(TRANSFER_TIMER);
     StopTimer(COMMUNICATION_TIMER);
 }
 
+//================================================================
+//reduce
+//Binomial tree to MASTER_RANK, ceil(log2(#workers)) rounds: a worker
+//merges what its children send, merge(um) for each of them, then sends
+//its own merged data, pack(m), to its parent. MASTER_RANK ends with the
+//data of all workers merged.
+template <class Merge, class Pack>
+void tree_reduce(Merge merge, Pack pack)
+{
+    StartTimer(COMMUNICATION_TIMER);
+    int np = _num_workers;
+    int r = (_my_rank - MASTER_RANK + np) % np; //rank relative to the root
+    for (int mask = 1; mask < np; mask <<= 1) {
+        if (r & mask) {
+            StartTimer(SERIALIZATION_TIMER);
+            ibinstream m;
+            pack(m);
+            StopTimer(SERIALIZATION_TIMER);
+            StartTimer(TRANSFER_TIMER);
+            send_ibinstream(m, (r - mask + MASTER_RANK) % np);
+            StopTimer(TRANSFER_TIMER);
+            break;
+        }
+        if (r + mask < np) {
+            StartTimer(TRANSFER_TIMER);
+            obinstream um = recv_obinstream((r + mask + MASTER_RANK) % np);
+            StopTimer(TRANSFER_TIMER);
+            StartTimer(SERIALIZATION_TIMER);
+            merge(um);
+            StopTimer(SERIALIZATION_TIMER);
+        }
+    }
+    StopTimer(COMMUNICATION_TIMER);
+}
+
 //================================================================
 //bcast
 template <class T>
@@ -465,14 +784,14 @@ void masterBcast(T& to_send)
     StartTimer(SERIALIZATION_TIMER);
     ibinstream m;
     m << to_send;
-    int size = m.size();
+    size_t size = m.size();
     StopTimer(SERIALIZATION_TIMER);
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Bcast(&size, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    pregel_bcast(&size, sizeof(size_t));
 
     char* sendbuf = m.get_buf();
-    MPI_Bcast(sendbuf, size, MPI_CHAR, MASTER_RANK, MPI_COMM_WORLD);
+    pregel_bcast(sendbuf, size);
     StopTimer(TRANSFER_TIMER);
 
     StopTimer(COMMUNICATION_TIMER);
@@ -483,15 +802,15 @@ void slaveBcast(T& to_get)
 { //broadcast
     StartTimer(COMMUNICATION_TIMER);
 
-    int size;
+    size_t size;
 
     StartTimer(TRANSFER_TIMER);
-    MPI_Bcast(&size, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    pregel_bcast(&size, sizeof(size_t));
     StopTimer(TRANSFER_TIMER);
 
     StartTimer(TRANSFER_TIMER);
     char* recvbuf = new char[size]; //obinstream will delete it
-    MPI_Bcast(recvbuf, size, MPI_CHAR, MASTER_RANK, MPI_COMM_WORLD);
+    pregel_bcast(recvbuf, size);
     StopTimer(TRANSFER_TIMER);
 
     StartTimer(SERIALIZATION_TIMER);
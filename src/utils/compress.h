@@ -0,0 +1,261 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+//Wire compression of the point-to-point buffers (-compress), applied by
+//send_ibinstream/recv_buffer to each buffer sent to a partner.
+//The codec writes the LZ4 block format (tokens of literal and match
+//lengths, literals, 2-byte match offsets) and needs no library: mapping
+//rows and branch trees, runs of small ints, compress well with it.
+//With -compress auto, a buffer of at least COMPRESS_MIN bytes is
+//compressed when it pays on the link to its partner: compressing costs
+//raw / speed seconds and saves raw * (1 - ratio) / link seconds on the
+//wire, ratio and speed being moving averages measured on the earlier
+//buffers sent to that partner, and link on the buffers received from it
+//(timed from their header to their last byte, so that waiting for the
+//partner to be ready is not counted).
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "time.h"
+#include "global.h"
+using namespace std;
+
+enum COMPRESS_MODES {
+    COMPRESS_OFF = 0,
+    COMPRESS_ON = 1, //every buffer of at least COMPRESS_MIN bytes
+    COMPRESS_AUTO = 2 //as decided by the link model
+};
+
+#define COMPRESS_MIN 4096 //smaller buffers are always sent raw
+#define COMPRESS_PROBE 16 //auto: compress one buffer after so many raw ones, to follow the ratio
+
+WORKER_LOCAL(int, global_compress_mode, COMPRESS_OFF);
+
+inline void set_compress_mode(int mode)
+{
+    global_compress_mode = mode;
+}
+
+//============================================
+//codec
+#define LZ_HASH_LOG 14
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 //the block ends with literals
+#define LZ_MFLIMIT 12 //no match starts in the last bytes
+#define LZ_MAX_OFFSET 65535
+
+//worst-case compressed size of n bytes
+inline size_t lz_bound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+inline uint32_t lz_read32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t lz_read64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+//the bytes of a length beyond the 15 of its token
+inline unsigned char* lz_put_len(unsigned char* op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+inline unsigned char* lz_put_literals(unsigned char* op, unsigned char* token,
+    const unsigned char* from, size_t len)
+{
+    *token = (unsigned char)((len >= 15 ? 15 : len) << 4);
+    if (len >= 15)
+        op = lz_put_len(op, len - 15);
+    memcpy(op, from, len);
+    return op + len;
+}
+
+//compresses n bytes of src into dst, of at least lz_bound(n) bytes,
+//returns the compressed size
+size_t lz_compress(const char* source, size_t n, char* dest)
+{
+    const unsigned char* src = (const unsigned char*)source;
+    unsigned char* op = (unsigned char*)dest;
+    const unsigned char* ip = src;
+    const unsigned char* anchor = src; //first literal not written yet
+    const unsigned char* end = src + n;
+    if (n > LZ_MFLIMIT) {
+        vector<size_t> table(1 << LZ_HASH_LOG, 0); //hash -> last position
+        const unsigned char* mflimit = end - LZ_MFLIMIT;
+        const unsigned char* matchlimit = end - LZ_LAST_LITERALS;
+        while (ip < mflimit) {
+            uint32_t seq = lz_read32(ip);
+            uint32_t h = lz_hash(seq);
+            const unsigned char* ref = src + table[h];
+            table[h] = ip - src;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+                ip += 1 + ((ip - anchor) >> 6); //skip faster on incompressible data
+                continue;
+            }
+            const unsigned char* mp = ip + LZ_MIN_MATCH;
+            const unsigned char* rp = ref + LZ_MIN_MATCH;
+            while (mp + 8 <= matchlimit) {
+                uint64_t diff = lz_read64(mp) ^ lz_read64(rp);
+                if (diff != 0) {
+                    mp += __builtin_ctzll(diff) >> 3; //little-endian
+                    break;
+                }
+                mp += 8;
+                rp += 8;
+            }
+            while (mp < matchlimit && *mp == *(ref + (mp - ip)))
+                mp++;
+            unsigned char* token = op++;
+            op = lz_put_literals(op, token, anchor, ip - anchor);
+            size_t offset = ip - ref;
+            *op++ = (unsigned char)(offset & 255);
+            *op++ = (unsigned char)(offset >> 8);
+            size_t mlen = mp - ip - LZ_MIN_MATCH;
+            *token |= (unsigned char)(mlen >= 15 ? 15 : mlen);
+            if (mlen >= 15)
+                op = lz_put_len(op, mlen - 15);
+            ip = anchor = mp;
+        }
+    }
+    unsigned char* token = op++;
+    op = lz_put_literals(op, token, anchor, end - anchor);
+    return op - (unsigned char*)dest;
+}
+
+//decompresses n bytes of src into dst, of raw bytes; returns false if
+//they do not decode to exactly raw bytes
+bool lz_decompress(const char* source, size_t n, char* dest, size_t raw)
+{
+    const unsigned char* ip = (const unsigned char*)source;
+    const unsigned char* iend = ip + n;
+    unsigned char* op = (unsigned char*)dest;
+    unsigned char* oend = op + raw;
+    while (ip < iend) {
+        unsigned int token = *ip++;
+        size_t len = token >> 4;
+        if (len == 15) {
+            unsigned int b;
+            do {
+                b = *ip++;
+                len += b;
+            } while (b == 255 && ip < iend);
+        }
+        if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+            return false;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip >= iend)
+            break; //the last literals
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        len = token & 15;
+        if (len == 15) {
+            unsigned int b;
+            do {
+                b = *ip++;
+                len += b;
+            } while (b == 255 && ip < iend);
+        }
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char*)dest)
+            || len > (size_t)(oend - op))
+            return false;
+        const unsigned char* ref = op - offset;
+        if (offset >= len)
+            memcpy(op, ref, len);
+        else
+            for (size_t i = 0; i < len; i++) //overlapping copy, a run
+                op[i] = ref[i];
+        op += len;
+    }
+    return op == oend;
+}
+
+//============================================
+//link model of -compress auto, one per partner
+struct LinkModel {
+    double ratio; //compressed size / raw size, < 0 if not measured yet
+    double speed; //compression, raw bytes per second
+    double link; //transfer, bytes per second, < 0 if not measured yet
+    int raw_run; //raw buffers of COMPRESS_MIN bytes or more sent since the last compressed one
+
+    LinkModel()
+        : ratio(-1)
+        , speed(-1)
+        , link(-1)
+        , raw_run(0)
+    {
+    }
+};
+
+WORKER_LOCAL(vector<LinkModel>, _link_models);
+
+inline LinkModel& get_link_model(int dst)
+{
+    if (_link_models.size() != _num_workers)
+        _link_models.resize(_num_workers);
+    return _link_models[dst];
+}
+
+inline void moving_average(double& avg, double x)
+{
+    avg = (avg < 0) ? x : 0.75 * avg + 0.25 * x;
+}
+
+//whether to compress a buffer of size bytes to dst
+bool should_compress(int dst, size_t size)
+{
+    if (global_compress_mode == COMPRESS_OFF || size < COMPRESS_MIN)
+        return false;
+    if (global_compress_mode == COMPRESS_ON)
+        return true;
+    LinkModel& l = get_link_model(dst);
+    bool pays;
+    if (l.link < 0)
+        pays = false; //nothing received from dst yet, the link is unknown
+    else if (l.ratio < 0 || l.speed <= 0 || l.raw_run >= COMPRESS_PROBE)
+        pays = true; //measure the ratio
+    else
+        pays = 1 / l.speed < (1 - l.ratio) / l.link;
+    if (!pays)
+        l.raw_run++;
+    return pays;
+}
+
+void record_compression(int dst, size_t raw, size_t wire, double seconds)
+{
+    LinkModel& l = get_link_model(dst);
+    moving_average(l.ratio, (double)wire / raw);
+    if (seconds > 0)
+        moving_average(l.speed, raw / seconds);
+    l.raw_run = 0;
+}
+
+void record_transfer(int src, size_t wire, double seconds)
+{
+    if (wire < COMPRESS_MIN || seconds <= 0)
+        return; //latency, not bandwidth
+    moving_average(get_link_model(src).link, wire / seconds);
+}
+
+#endif
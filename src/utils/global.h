@@ -6,20 +6,23 @@
 #include <limits.h>
 #include <string>
 #include <map>
+#include <atomic>
+#include <thread>
 #include <ext/hash_set>
 #include <ext/hash_map>
 #define hash_map __gnu_cxx::hash_map
 #define hash_set __gnu_cxx::hash_set
 #include <assert.h> //for ease of debug
+#include "transport.h"
 using namespace std;
 
 //============================
 ///worker info
 #define MASTER_RANK 0
 
-int _my_rank;
-int _num_workers;
-int _dummy_vertex_id = 0;
+WORKER_LOCAL(int, _my_rank);
+WORKER_LOCAL(int, _num_workers);
+atomic<int> _dummy_vertex_id(0); //decremented by concurrent compute() calls
 
 inline int get_worker_id()
 {
@@ -33,30 +36,75 @@ inline int create_dummy_vertex_id()
 {
     // only call once for each dummy vertex
     // start from -1
-    _dummy_vertex_id--;
-    return _dummy_vertex_id;
+    return --_dummy_vertex_id;
 }
 inline int get_dummy_vertex_id()
 {
     return _dummy_vertex_id;
 }
 
+inline void set_transport(Transport* t)
+{
+    _transport = t;
+    _my_rank = t->rank();
+    _num_workers = t->size();
+}
+
+#ifndef THREAD_TRANSPORT
 
 void init_workers()
 {
     MPI_Init(NULL, NULL);
-    MPI_Comm_size(MPI_COMM_WORLD, &_num_workers);
-    MPI_Comm_rank(MPI_COMM_WORLD, &_my_rank);
+    set_transport(new MpiTransport);
 }
 
 void worker_finalize()
 {
+    delete _transport;
+    _transport = NULL;
     MPI_Finalize();
 }
 
+//runs job() on this worker, one of the MPI processes (their number is
+//given to mpiexec, n is ignored)
+template <class Job>
+void run_workers(int, Job job)
+{
+    init_workers();
+    job();
+    worker_finalize();
+}
+
+#else
+
+//runs job() on n workers, threads of this process
+template <class Job>
+void run_workers(int n, Job job)
+{
+    ThreadHub hub(n);
+    vector<WorkerContext*> contexts(n);
+    vector<thread> workers;
+    for (int i = 0; i < n; i++) {
+        contexts[i] = new WorkerContext;
+        workers.push_back(thread([&, i]() {
+            adopt_worker(contexts[i]);
+            ThreadTransport transport(&hub, i);
+            set_transport(&transport);
+            job();
+            _transport = NULL;
+        }));
+    }
+    for (int i = 0; i < n; i++)
+        workers[i].join();
+    for (int i = 0; i < n; i++)
+        delete contexts[i];
+}
+
+#endif
+
 void worker_barrier()
 {
-    MPI_Barrier(MPI_COMM_WORLD);
+    get_transport().barrier();
 }
 
 
@@ -85,19 +133,19 @@ typedef int uID;
 
 //============================
 //global variables (original)
-int global_step_num;
+WORKER_LOCAL(int, global_step_num);
 inline int step_num()
 {
     return global_step_num;
 }
 
-int global_phase_num;
+WORKER_LOCAL(int, global_phase_num);
 inline int phase_num()
 {
     return global_phase_num;
 }
 
-void* global_message_buffer = NULL;
+WORKER_LOCAL(void*, global_message_buffer);
 inline void set_message_buffer(void* mb)
 {
     global_message_buffer = mb;
@@ -107,7 +155,7 @@ inline void* get_message_buffer()
     return global_message_buffer;
 }
 
-void* global_combiner = NULL;
+WORKER_LOCAL(void*, global_combiner);
 inline void set_combiner(void* cb)
 {
     global_combiner = cb;
@@ -117,7 +165,7 @@ inline void* get_combiner()
     return global_combiner;
 }
 
-void* global_aggregator = NULL;
+WORKER_LOCAL(void*, global_aggregator);
 inline void set_aggregator(void* ag)
 {
     global_aggregator = ag;
@@ -127,18 +175,18 @@ inline void* get_aggregator()
     return global_aggregator;
 }
 
-void* global_agg = NULL; //for aggregator, FinalT of last round
+WORKER_LOCAL(void*, global_agg); //for aggregator, FinalT of last round
 inline void* getAgg()
 {
     return global_agg;
 }
 
-int global_vnum = 0;
+WORKER_LOCAL(int, global_vnum);
 inline int& get_vnum()
 {
     return global_vnum;
 }
-int global_active_vnum = 0;
+WORKER_LOCAL(int, global_active_vnum);
 inline int& active_vnum()
 {
     return global_active_vnum;
@@ -157,7 +205,7 @@ enum BITS {
     WAKE_ALL_ORBIT = 2
 };
 //currently, only 3 bits are used, others can be defined by users
-char global_bor_bitmap;
+WORKER_LOCAL(char, global_bor_bitmap);
 
 void clearBits()
 {
@@ -193,7 +241,7 @@ void forceTerminate()
 //Set up a pointer to query in global.h
 //so that it can be used anywhere in the program
 
-void* global_query = NULL;
+WORKER_LOCAL(void*, global_query);
 
 inline void* getQuery()
 {
@@ -250,17 +298,28 @@ int math_choose(int m, int n)
     DataPath = 0,           // -d, the data file path (folder)
     QueryPath = 1,     		// -q, the query file path (folder)
     OutputPath = 2,      	// -out, output path (folder)
-    Input = 3,        	    // -input, default or g-thinker
+    Input = 3,        	    // -input, HDFS or local (POSIX files, "-d -" for stdin)
     Report = 4,     	    // -report, detailed report or concise report
     Order = 5,              // -order, the priority in deciding match order
     Preprocess = 6,         // -preprocess
     Filter = 7,             // -filter, optimization technique 1: filtering
     Pseudo = 8, 	    	// -pseudo, optimization technique 2: pseudo-child
     Leaf = 9,				// -leaf, optimization technique 3: leaf folding
-    Other = 10				// -other, other optimization technique
+    Other = 10,				// -other, other optimization technique
+    Ghost = 11,				// -ghost, degree threshold of hub mirroring (0 = off)
+    Metrics = 12,			// -metrics, per-superstep metrics file (.json or .csv)
+    Direct = 13,			// -direct, O_DIRECT reads of local input
+    Threads = 14,			// -threads, threads per worker (default 1)
+    Balance = 15,			// -balance, max/avg load ratio that triggers rebalancing (0 = off)
+    Symmetry = 16,			// -symmetry, symmetry breaking: off, on (embeddings) or unique (subgraphs)
+    Compress = 17,			// -compress, wire compression of the exchanged buffers: off, on or auto
+    Shm = 18,				// -shm, shared memory transport between the workers of a host (default on)
+    Hier = 19,				// -hier, hierarchical exchange between hosts through their leaders
+    Workers = 20,			// -workers, workers started as threads, with the thread transport (default 1)
+    AggSync = 21			// -aggsync, how the aggregator is synchronized: pod (default), tree or gather
 */
 
-#define OPTIONS 11
+#define OPTIONS 22
 
 class MatchingCommand{
     vector<string> tokens;
@@ -286,7 +345,9 @@ public:
     MatchingCommand(const int argc, char **argv)
     {
     	options_key = {"-d", "-q", "-out", "-input", "-report", "-order",
-                "-preprocess", "-filter", "-pseudo",  "-leaf", "-other"};
+                "-preprocess", "-filter", "-pseudo",  "-leaf", "-other", "-ghost", "-metrics",
+                "-direct", "-threads", "-balance", "-symmetry", "-compress", "-shm", "-hier",
+                "-workers", "-aggsync"};
     	for (int i = 1; i < argc; ++i)
             tokens.push_back(std::string(argv[i]));
         processOptions();
@@ -295,6 +356,7 @@ public:
     string getDataPath() { return options_value[0]; }
     string getQueryPath() { return options_value[1]; }
     string getOutputPath() { return options_value[2]; }
+    string getMetricsPath() { return options_value[12]; }
 
     bool getInputMethod() 
     {
@@ -324,6 +386,67 @@ public:
         return (options_value[i] == "on"); 
     }
 
+    int getThreads()
+    {
+        int n = atoi(options_value[14].c_str());
+        return n > 0 ? n : 1;
+    }
+
+    int getWorkers()
+    {
+        int n = atoi(options_value[20].c_str());
+        return n > 0 ? n : 1;
+    }
+
+    double getBalanceRatio()
+    {
+        if (options_value[15] == "")
+            return 0;
+        return atof(options_value[15].c_str());
+    }
+
+    int getGhostThreshold()
+    {
+        if (options_value[11] == "")
+            return 0;
+        return atoi(options_value[11].c_str());
+    }
+
+    int getSymmetryMode()
+    {
+        if (options_value[16] == "on")
+            return 1;
+        else if (options_value[16] == "unique")
+            return 2;
+        else
+            return 0;
+    }
+
+    bool isShmOn()
+    {
+        return options_value[18] != "off";
+    }
+
+    int getCompressMode()
+    {
+        if (options_value[17] == "on")
+            return 1;
+        else if (options_value[17] == "auto")
+            return 2;
+        else
+            return 0;
+    }
+
+    int getAggSyncMode()
+    {
+        if (options_value[21] == "gather")
+            return 0;
+        else if (options_value[21] == "tree")
+            return 1;
+        else
+            return 2;
+    }
+
 };
 
 //------------------------
@@ -333,16 +456,35 @@ struct WorkerParams {
     string data_path;
     string query_path;
     string output_path;
+    string metrics_path; // empty for no metrics export
     bool force_write;
 
     bool input; // 1 for HDFS, 0 for local
+    bool direct; // O_DIRECT for local input
     int report; // 0 for short, 1 for long, 2 for long+step_msg
     string order;
     bool preprocess, filter, pseudo, leaf, other;   
+    int ghost; // degree threshold of ghost mirroring, 0 for off
+    int threads; // threads per worker
+    int workers; // workers started as threads (thread transport only)
+    double balance; // max/avg load ratio of rebalancing, 0 for off
+    int symmetry; // 0 for off, 1 for embeddings, 2 for unique subgraphs
+    int compress; // 0 for off, 1 for on, 2 for auto (see COMPRESS_MODES)
+    bool shm; // shared memory transport between the workers of a host
+    bool hier; // hierarchical exchange between hosts, needs shm
+    int aggsync; // 0 for gather, 1 for tree, 2 for pod (see AGG_SYNC_MODES)
     
     WorkerParams()
     {
         force_write = true;
+        threads = 1;
+        workers = 1;
+        balance = 0;
+        symmetry = 0;
+        compress = 0;
+        shm = true;
+        hier = false;
+        aggsync = 2;
     }
 
     WorkerParams(MatchingCommand &command, bool fw)
@@ -350,6 +492,7 @@ struct WorkerParams {
         data_path = command.getDataPath();
         query_path = command.getQueryPath();
         output_path = command.getOutputPath();
+        metrics_path = command.getMetricsPath();
         force_write = fw;
         input = command.getInputMethod();
         report = command.getReportMethod();
@@ -359,41 +502,86 @@ struct WorkerParams {
         pseudo = command.isMethodOn(8);
         leaf = command.isMethodOn(9);
         other = command.isMethodOn(10);
-        
+        ghost = command.getGhostThreshold();
+        direct = command.isMethodOn(13);
+        threads = command.getThreads();
+        workers = command.getWorkers();
+        balance = command.getBalanceRatio();
+        symmetry = command.getSymmetryMode();
+        compress = command.getCompressMode();
+        shm = command.isShmOn();
+        hier = command.isMethodOn(19);
+        aggsync = command.getAggSyncMode();
+
     }
 
     void print()
     {
-        cout << "Data graph path: " << data_path << endl;
+        cout << "Data graph path ";
+        if (input) cout << "(HDFS): " << data_path << endl;
+        else cout << "(local" << (direct ? ", O_DIRECT" : "") << "): " << data_path << endl;
         cout << "Query graph path ";
         if (input) cout << "(HDFS): " << query_path << endl;
         else cout << "(local): " << query_path << endl;
         cout << "Input Format (1 for default, 0 for g-thinker): " << input << endl;
         cout << "Output graph path: " << output_path << endl;
+        if (metrics_path != "")
+            cout << "Metrics path: " << metrics_path << endl;
+#ifdef THREAD_TRANSPORT
+        cout << "Workers (threads of this process): " << workers << endl;
+#endif
+        if (threads > 1)
+            cout << "Threads per worker: " << threads << endl;
+        if (aggsync != 2)
+            cout << "Aggregator sync: " << (aggsync == 1 ? "tree" : "gather") << endl;
         cout << "Optimization techniques: ";
         if (preprocess) cout << "Preprocessing/";
         if (filter) cout << "Filtering/";
         if (pseudo) cout << "Pseudo-children Counting/";
         if (leaf) cout << "Leaf Folding/";
+        if (ghost > 0) cout << "Ghost Mirroring (degree > " << ghost << ")/";
+        if (balance > 0) cout << "Load Rebalancing (max/avg > " << balance << ")/";
+        if (symmetry == 1) cout << "Symmetry Breaking/";
+        if (symmetry == 2) cout << "Symmetry Breaking (unique subgraphs)/";
+        if (compress == 1) cout << "Wire Compression/";
+        if (compress == 2) cout << "Wire Compression (auto)/";
+        if (shm && hier) cout << "Hierarchical Exchange/";
         cout << endl;
     }
 };
 
 //====================================================
 //Ghost threshold
-int global_ghost_threshold;
+//vertices with degree > threshold are mirrored on every worker
+WORKER_LOCAL(int, global_ghost_threshold);
 
 void set_ghost_threshold(int tau)
 {
     global_ghost_threshold = tau;
 }
 
+inline int get_ghost_threshold()
+{
+    return global_ghost_threshold;
+}
+
+WORKER_LOCAL(void*, global_ghosts); //hash_map<vID, VertexT*> of mirrored hubs
+inline void* getGhosts()
+{
+    return global_ghosts;
+}
+
+//====================================================
+//Load rebalancing (-balance), see Worker::balance_load
+#define BALANCE_TOP_K 16 //heaviest vertices reported by each worker
+#define BALANCE_MIN_SHARE 64 //smallest load range worth shipping
+
 //====================================================
 #define ROUND 11 //for PageRank
 
 //====================================================
 // a useful debugging tool, used with if statement to filter
-bool printOnce = true;
+WORKER_LOCAL(bool, printOnce, true);
 
 #endif
 
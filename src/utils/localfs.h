@@ -0,0 +1,560 @@
+#ifndef LOCALFS_H
+#define LOCALFS_H
+
+//POSIX input backend, used when the job runs with "-input local"
+//(the only backend of a build with -DNO_HDFS, see "make local").
+//Data path forms:
+//  - a directory: every regular file is one split, splits are assigned to
+//    workers greedily by size (as dispatchRan() does on HDFS)
+//  - a single file: cut into one byte range per worker, read in parallel
+//    with pread(); a line belongs to the range holding its first byte
+//  - "-": standard input, read by MASTER_RANK only
+//O_DIRECT (-direct on) bypasses the page cache for cold one-shot reads;
+//it falls back to buffered reads if the file system refuses it.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //O_DIRECT
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "serialization.h"
+#include "global.h"
+using namespace std;
+
+#define LOCAL_BUF_SIZE 1048576 //1M, a multiple of LOCAL_ALIGN
+#define LOCAL_ALIGN 4096 //O_DIRECT offset/length/buffer alignment
+#define LOCAL_LINE_SIZE 4096
+#define LOCAL_WRITE_SIZE 8388608 //8M
+#define LOCAL_BLOCK_SIZE 16777216 //16M per loader thread
+
+//====== Splits ======
+
+//byte range [begin, end) of a file, end < 0 means "to the end of file"
+struct LocalSplit {
+    string path;
+    long long begin;
+    long long end;
+};
+
+ibinstream& operator<<(ibinstream& m, const LocalSplit& s)
+{
+    m << s.path;
+    m.raw_bytes(&s.begin, sizeof(long long));
+    m.raw_bytes(&s.end, sizeof(long long));
+    return m;
+}
+
+obinstream& operator>>(obinstream& m, LocalSplit& s)
+{
+    m >> s.path;
+    s.begin = *(long long*)m.raw_bytes(sizeof(long long));
+    s.end = *(long long*)m.raw_bytes(sizeof(long long));
+    return m;
+}
+
+inline bool isStdinPath(const string& path)
+{
+    return path == "-";
+}
+
+int localDirCheck(const char* indir) //returns -1 if fail, 0 if succeed
+{
+    struct stat st;
+    if (isStdinPath(indir) || stat(indir, &st) == 0)
+        return 0;
+    fprintf(stderr, "Input path \"%s\" does not exist!\n", indir);
+    return -1;
+}
+
+vector<vector<LocalSplit> >* localDispatch(const char* inpath) //remember to delete assignment after used
+{
+    vector<vector<LocalSplit> >* assignmentPointer = new vector<vector<LocalSplit> >(_num_workers);
+    vector<vector<LocalSplit> >& assignment = *assignmentPointer;
+    if (isStdinPath(inpath)) {
+        LocalSplit s = { inpath, 0, -1 };
+        assignment[MASTER_RANK].push_back(s);
+        return assignmentPointer;
+    }
+    struct stat st;
+    stat(inpath, &st);
+    if (!S_ISDIR(st.st_mode)) {
+        //one file: equal byte ranges, the lines are aligned by the readers
+        long long size = st.st_size;
+        for (int i = 0; i < _num_workers; i++) {
+            LocalSplit s = { inpath, size * i / _num_workers, size * (i + 1) / _num_workers };
+            assignment[i].push_back(s);
+        }
+        return assignmentPointer;
+    }
+    //a directory: whole files, largest first to the least loaded worker
+    DIR* dir = opendir(inpath);
+    if (dir == NULL) {
+        fprintf(stderr, "Failed to list directory %s!\n", inpath);
+        exit(-1);
+    }
+    vector<pair<long long, string> > files;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_name[0] == '_')
+            continue; //hidden files, _SUCCESS, etc.
+        string fname = string(inpath) + "/" + entry->d_name;
+        if (stat(fname.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            files.push_back(make_pair((long long)st.st_size, fname));
+    }
+    closedir(dir);
+    sort(files.rbegin(), files.rend());
+    vector<long long> assigned(_num_workers, 0);
+    for (size_t i = 0; i < files.size(); i++) {
+        int min = min_element(assigned.begin(), assigned.end()) - assigned.begin();
+        LocalSplit s = { files[i].second, 0, -1 };
+        assignment[min].push_back(s);
+        assigned[min] += files[i].first;
+    }
+    return assignmentPointer;
+}
+
+//====== Read ======
+
+//returns the descriptor, "direct" is cleared if O_DIRECT is refused
+int localOpen(const string& path, bool& direct)
+{
+    if (isStdinPath(path)) {
+        direct = false;
+        return STDIN_FILENO;
+    }
+    int fd = -1;
+    if (direct)
+        fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+    if (fd == -1) { //O_DIRECT unsupported (e.g. tmpfs)
+        direct = false;
+        fd = open(path.c_str(), O_RDONLY);
+    }
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        exit(-1);
+    }
+    return fd;
+}
+
+//LOCAL_ALIGN-aligned buffer of "size" bytes, plus one for a '\0'
+char* localAlloc(long long size)
+{
+    char* buf;
+    if (posix_memalign((void**)&buf, LOCAL_ALIGN, size + LOCAL_ALIGN) != 0) {
+        fprintf(stderr, "Failed to allocate the read buffer!\n");
+        exit(-1);
+    }
+    return buf;
+}
+
+//reads up to "size" bytes at "offset" (ignored for stdin), short only at EOF
+long long localRead(int fd, bool direct, char* buf, long long size, long long offset)
+{
+    long long got = 0;
+    while (got < size) {
+        ssize_t n;
+        if (fd == STDIN_FILENO)
+            n = read(fd, buf + got, size - got);
+        else
+            n = pread(fd, buf + got, size - got, offset + got);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            fprintf(stderr, "Read Failure: %s\n", strerror(errno));
+            exit(-1);
+        }
+        if (n == 0)
+            break;
+        got += n;
+        if (direct && got % LOCAL_ALIGN != 0) //EOF reached
+            break;
+    }
+    return got;
+}
+
+//Block reader for parallel parsing: each nextBlock() returns a buffer
+//[first, last) of whole lines of the split (lines are separated by '\n',
+//the last one may end at "last"; *last is writable). The blocks are about
+//"block" bytes and are reread at an aligned offset, so O_DIRECT works.
+struct LocalBlockReader {
+    int fd;
+    bool direct;
+    bool fromStdin;
+    char* buf;
+    long long cap; //a multiple of LOCAL_ALIGN
+    long long len; //valid bytes in buf
+    long long next; //files: offset of the next line; stdin: its index in buf
+    long long end;
+    bool skip; //the line at "next" belongs to the previous split
+    bool done;
+
+    LocalBlockReader(const LocalSplit& split, bool use_direct, long long block)
+        : len(0)
+        , done(false)
+    {
+        fromStdin = isStdinPath(split.path);
+        direct = use_direct;
+        fd = localOpen(split.path, direct);
+        cap = (block + LOCAL_ALIGN - 1) / LOCAL_ALIGN * LOCAL_ALIGN;
+        buf = localAlloc(cap);
+        end = split.end < 0 ? LLONG_MAX : split.end;
+        //as LocalLineReader: start one byte early and skip up to '\n'
+        skip = split.begin > 0;
+        next = skip ? split.begin - 1 : 0;
+        done = split.begin >= end; //empty range
+    }
+
+    ~LocalBlockReader()
+    {
+        free(buf);
+        if (!fromStdin)
+            close(fd);
+    }
+
+    //internal use only!
+    void grow()
+    {
+        char* bigger = localAlloc(cap * 2);
+        memcpy(bigger, buf, len);
+        free(buf);
+        buf = bigger;
+        cap *= 2;
+    }
+
+    bool nextBlock(char*& first, char*& last)
+    {
+        if (done)
+            return false;
+        return fromStdin ? nextStdinBlock(first, last) : nextFileBlock(first, last);
+    }
+
+    //internal use only!
+    bool nextFileBlock(char*& first, char*& last)
+    {
+        while (true) {
+            long long bufOff = next - next % LOCAL_ALIGN;
+            len = localRead(fd, direct, buf, cap, bufOff);
+            bool eof = len < cap;
+            char* s = buf + (next - bufOff);
+            char* e = buf + len;
+            if (skip) {
+                char* nl = (char*)memchr(s, '\n', e - s);
+                if (nl == NULL && !eof) {
+                    grow();
+                    continue;
+                }
+                skip = false;
+                next = (nl == NULL ? bufOff + len : bufOff + (nl + 1 - buf));
+                if (next >= end || nl == NULL) {
+                    done = true;
+                    return false;
+                }
+                s = nl + 1;
+            }
+            if (s >= e) {
+                done = true;
+                return false;
+            }
+            char* stop;
+            if (end - bufOff <= len) {
+                //the split ends here: the last line is the one with byte end - 1
+                char* nl = (char*)memchr(buf + (end - bufOff - 1), '\n', len - (end - bufOff - 1));
+                if (nl == NULL && !eof) {
+                    grow();
+                    continue;
+                }
+                stop = (nl == NULL ? e : nl + 1);
+                done = true;
+            } else if (eof) {
+                stop = e;
+                done = true;
+            } else {
+                char* nl = (char*)memrchr(s, '\n', e - s);
+                if (nl == NULL) { //a line longer than the block
+                    grow();
+                    continue;
+                }
+                stop = nl + 1;
+            }
+            first = s;
+            last = stop;
+            next = bufOff + (stop - buf);
+            return true;
+        }
+    }
+
+    //internal use only!
+    bool nextStdinBlock(char*& first, char*& last)
+    {
+        //move the partial line of the previous block to the front
+        memmove(buf, buf + next, len - next);
+        len -= next;
+        next = 0;
+        while (true) {
+            long long got = localRead(fd, false, buf + len, cap - len, 0);
+            len += got;
+            bool eof = len < cap;
+            if (len == 0) {
+                done = true;
+                return false;
+            }
+            char* nl = (char*)memrchr(buf, '\n', len);
+            if (eof) {
+                next = len;
+                done = true;
+            } else if (nl == NULL) {
+                grow();
+                continue;
+            } else
+                next = nl + 1 - buf;
+            first = buf;
+            last = buf + next;
+            return true;
+        }
+    }
+};
+
+//====== Read line ======
+
+//same interface as LineReader of ydhdfs2.h:
+//after each readLine(), need to check eof(), if it's true, no line is read
+struct LocalLineReader {
+    int fd;
+    bool direct;
+    bool fromStdin;
+    char* buf; //LOCAL_ALIGN-aligned for O_DIRECT
+    int bufPos;
+    int bufSize;
+    long long filePos; //file offset of buf[0]
+    long long end; //stop once the next line starts at or after "end"
+    bool fileEnd;
+
+    char* line;
+    int length;
+    int size;
+
+    LocalLineReader(const LocalSplit& split, bool use_direct)
+        : bufPos(0)
+        , bufSize(0)
+        , fileEnd(false)
+        , length(0)
+        , size(LOCAL_LINE_SIZE)
+    {
+        fromStdin = isStdinPath(split.path);
+        direct = use_direct && !fromStdin;
+        fd = localOpen(split.path, direct);
+        buf = localAlloc(LOCAL_BUF_SIZE);
+        line = (char*)malloc(LOCAL_LINE_SIZE * sizeof(char));
+        end = split.end < 0 ? LLONG_MAX : split.end;
+        //start one byte early: if it is '\n', the first line is ours,
+        //otherwise the partial line belongs to the previous range
+        long long start = split.begin > 0 ? split.begin - 1 : 0;
+        filePos = start - start % LOCAL_ALIGN;
+        fill();
+        bufPos = start - filePos;
+        if (split.begin > 0)
+            readLine(); //skip
+    }
+
+    ~LocalLineReader()
+    {
+        free(buf);
+        free(line);
+        if (!fromStdin)
+            close(fd);
+    }
+
+    //internal use only!
+    void doubleLineBuf()
+    {
+        size *= 2;
+        line = (char*)realloc(line, size * sizeof(char));
+    }
+
+    //internal use only!
+    void lineAppend(const char* first, int num)
+    {
+        while (length + num + 1 > size)
+            doubleLineBuf();
+        memcpy(line + length, first, num);
+        length += num;
+    }
+
+    //internal use only!
+    void fill()
+    {
+        filePos += bufSize;
+        bufSize = localRead(fd, direct, buf, LOCAL_BUF_SIZE, filePos);
+        fileEnd = bufSize < LOCAL_BUF_SIZE;
+        bufPos = 0;
+    }
+
+    bool eof()
+    {
+        return length == 0 && (fileEnd && bufPos == bufSize);
+    }
+
+    //the line starts at "line", with "length" chars
+    void readLine()
+    {
+        length = 0;
+        bool ended = false; //'\n' found
+        while (!ended) {
+            if (bufPos == bufSize) {
+                if (fileEnd)
+                    break;
+                fill();
+                continue;
+            }
+            char* pch = (char*)memchr(buf + bufPos, '\n', bufSize - bufPos);
+            int validLen = (pch == NULL ? bufSize : pch - buf) - bufPos;
+            lineAppend(buf + bufPos, validLen);
+            bufPos += validLen;
+            if (pch != NULL) {
+                bufPos++; //skip '\n'
+                ended = true;
+            }
+        }
+    }
+
+    //file offset of the next unread byte
+    long long tell()
+    {
+        return filePos + bufPos;
+    }
+
+    //returns NULL when the range is exhausted, empty lines are skipped
+    char* nextLine()
+    {
+        do {
+            if (tell() >= end)
+                return NULL;
+            readLine();
+            if (eof())
+                return NULL;
+        } while (length == 0);
+        line[length] = '\0';
+        return line;
+    }
+
+    char* getLine()
+    {
+        line[length] = '\0';
+        return line;
+    }
+};
+
+//====== Write ======
+
+//mkdir -p, one path component at a time
+int localMakeDirs(const char* path)
+{
+    string dir(path);
+    for (size_t i = 1; i <= dir.size(); i++) {
+        if (i < dir.size() && dir[i] != '/')
+            continue;
+        string prefix = dir.substr(0, i);
+        if (mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST)
+            return -1;
+    }
+    struct stat st;
+    return (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) ? 0 : -1;
+}
+
+//with force, an existing directory is kept but the part files of an
+//earlier run (possibly with more workers) are removed
+int localOutDirCheck(const char* outdir, bool force) //returns -1 if fail, 0 if succeed
+{
+    struct stat st;
+    if (stat(outdir, &st) == 0) {
+        if (!force) {
+            fprintf(stderr, "Output path \"%s\" already exists!\n", outdir);
+            return -1;
+        }
+        DIR* dir = opendir(outdir);
+        if (dir == NULL) {
+            fprintf(stderr, "Output path \"%s\" is not a directory!\n", outdir);
+            return -1;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "part_", 5) != 0)
+                continue;
+            string file = string(outdir) + "/" + entry->d_name;
+            if (unlink(file.c_str()) != 0) {
+                fprintf(stderr, "Error deleting %s!\n", file.c_str());
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        return 0;
+    }
+    if (localMakeDirs(outdir) != 0) {
+        fprintf(stderr, "Failed to create output path \"%s\"!\n", outdir);
+        return -1;
+    }
+    return 0;
+}
+
+//writes "<path>/part_<me>", same interface as BufferedWriter of ydhdfs2.h
+struct LocalBufferedWriter {
+    FILE* file;
+    vector<char> buf;
+
+    LocalBufferedWriter(const char* path, int me)
+    {
+        char fname[20];
+        sprintf(fname, "part_%d", me);
+        string filePath = string(path) + "/" + fname;
+        file = fopen(filePath.c_str(), "w");
+        if (file == NULL) {
+            fprintf(stderr, "Failed to open %s for writing!\n", filePath.c_str());
+            exit(-1);
+        }
+    }
+
+    ~LocalBufferedWriter()
+    {
+        flush();
+        fclose(file);
+    }
+
+    //internal use only!
+    void flush()
+    {
+        if (buf.size() > 0 && fwrite(&buf[0], 1, buf.size(), file) != buf.size()) {
+            fprintf(stderr, "Failed to write file!\n");
+            exit(-1);
+        }
+        buf.clear();
+    }
+
+    void check()
+    {
+        if (buf.size() >= LOCAL_WRITE_SIZE)
+            flush();
+    }
+
+    void write(const char* content)
+    {
+        int len = strlen(content);
+        buf.insert(buf.end(), content, content + len);
+    }
+};
+
+#ifdef NO_HDFS
+typedef LocalBufferedWriter BufferedWriter;
+#endif
+
+#endif
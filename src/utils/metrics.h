@@ -0,0 +1,211 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include "time.h"
+#include "serialization.h"
+#include "global.h"
+using namespace std;
+
+//============================================
+//per-partner byte counters, updated by send_ibinstream
+WORKER_LOCAL(vector<long long>, _bytes_sent); //on the wire, i.e. compressed
+WORKER_LOCAL(long long, _total_bytes_sent); //to all partners
+WORKER_LOCAL(long long, _raw_bytes_sent); //to all partners, before compression
+
+inline void count_bytes_sent(int dst, size_t size, size_t raw)
+{
+    if (_bytes_sent.size() != _num_workers)
+        _bytes_sent.resize(_num_workers, 0);
+    _bytes_sent[dst] += size;
+    _total_bytes_sent += size;
+    _raw_bytes_sent += raw;
+}
+
+long long get_peak_rss()
+{ //in KB
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+//============================================
+//metrics of one worker in one superstep
+struct StepMetrics {
+    int phase; //COMPUTE_TYPES
+    int step;
+    int worker;
+    double active_compute;
+    double sync_message;
+    double serialization;
+    double transfer;
+    double sync;
+    double compress; //compression and decompression
+    long long msg_num;
+    long long vadd_num;
+    long long peak_rss;
+    long long raw_bytes; //sum of bytes_sent before compression
+    vector<long long> bytes_sent; //length = #workers
+};
+
+ibinstream& operator<<(ibinstream& m, const StepMetrics& s)
+{
+    m << s.phase << s.step << s.worker;
+    m << s.active_compute << s.sync_message << s.serialization
+      << s.transfer << s.sync << s.compress;
+    m.raw_bytes(&s.msg_num, sizeof(long long));
+    m.raw_bytes(&s.vadd_num, sizeof(long long));
+    m.raw_bytes(&s.peak_rss, sizeof(long long));
+    m.raw_bytes(&s.raw_bytes, sizeof(long long));
+    m << s.bytes_sent.size();
+    m.raw_bytes(&s.bytes_sent[0], s.bytes_sent.size() * sizeof(long long));
+    return m;
+}
+
+obinstream& operator>>(obinstream& m, StepMetrics& s)
+{
+    m >> s.phase >> s.step >> s.worker;
+    m >> s.active_compute >> s.sync_message >> s.serialization
+      >> s.transfer >> s.sync >> s.compress;
+    s.msg_num = *(long long*)m.raw_bytes(sizeof(long long));
+    s.vadd_num = *(long long*)m.raw_bytes(sizeof(long long));
+    s.peak_rss = *(long long*)m.raw_bytes(sizeof(long long));
+    s.raw_bytes = *(long long*)m.raw_bytes(sizeof(long long));
+    size_t size;
+    m >> size;
+    long long* data = (long long*)m.raw_bytes(size * sizeof(long long));
+    s.bytes_sent.assign(data, data + size);
+    return m;
+}
+
+//============================================
+//recorder: snapshot at the beginning of a superstep, record at the end
+const int N_Metric_Timers = 6;
+const int _metric_timers[N_Metric_Timers] = { ACTIVE_COMPUTE_TIMER,
+    SYNC_MESSAGE_TIMER, SERIALIZATION_TIMER, TRANSFER_TIMER, SYNC_TIMER,
+    COMPRESS_TIMER };
+
+typedef double MetricSnapshot[N_Metric_Timers];
+WORKER_LOCAL(bool, global_metrics_on, false);
+WORKER_LOCAL(vector<StepMetrics>, _step_metrics);
+WORKER_LOCAL(MetricSnapshot, _metric_snapshot);
+WORKER_LOCAL(vector<long long>, _bytes_snapshot);
+WORKER_LOCAL(long long, _raw_snapshot);
+
+inline void set_metrics(bool on)
+{
+    global_metrics_on = on;
+}
+
+void metrics_step_begin()
+{
+    if (!global_metrics_on)
+        return;
+    for (int i = 0; i < N_Metric_Timers; i++)
+        _metric_snapshot[i] = get_timer(_metric_timers[i]);
+    _bytes_sent.resize(_num_workers, 0);
+    _bytes_snapshot = _bytes_sent;
+    _raw_snapshot = _raw_bytes_sent;
+}
+
+void metrics_step_end(int phase, int step, long long msg_num, long long vadd_num)
+{
+    if (!global_metrics_on)
+        return;
+    StepMetrics s;
+    s.phase = phase;
+    s.step = step;
+    s.worker = _my_rank;
+    double delta[N_Metric_Timers];
+    for (int i = 0; i < N_Metric_Timers; i++)
+        delta[i] = get_timer(_metric_timers[i]) - _metric_snapshot[i];
+    s.active_compute = delta[0];
+    s.sync_message = delta[1];
+    s.serialization = delta[2];
+    s.transfer = delta[3];
+    s.sync = delta[4];
+    s.compress = delta[5];
+    s.msg_num = msg_num;
+    s.vadd_num = vadd_num;
+    s.peak_rss = get_peak_rss();
+    s.raw_bytes = _raw_bytes_sent - _raw_snapshot;
+    s.bytes_sent.resize(_num_workers);
+    for (int i = 0; i < _num_workers; i++)
+        s.bytes_sent[i] = _bytes_sent[i] - _bytes_snapshot[i];
+    _step_metrics.push_back(s);
+}
+
+//============================================
+//writers, called by MASTER_RANK only
+const char* phase_name(int phase)
+{
+    switch (phase) {
+    case PREPROCESS:
+        return "preprocess";
+    case MATCH:
+        return "match";
+    case ENUMERATE:
+        return "enumerate";
+    default:
+        return "filter";
+    }
+}
+
+void write_metrics_csv(FILE* f, vector<StepMetrics>& all)
+{
+    fprintf(f, "phase,step,worker,active_compute,sync_message,serialization,"
+               "transfer,sync,compress,msg_num,vadd_num,peak_rss_kb,raw_bytes");
+    for (int i = 0; i < _num_workers; i++)
+        fprintf(f, ",bytes_to_%d", i);
+    fprintf(f, "\n");
+    for (size_t i = 0; i < all.size(); i++) {
+        StepMetrics& s = all[i];
+        fprintf(f, "%s,%d,%d,%f,%f,%f,%f,%f,%f,%lld,%lld,%lld,%lld",
+            phase_name(s.phase), s.step, s.worker, s.active_compute,
+            s.sync_message, s.serialization, s.transfer, s.sync,
+            s.compress, s.msg_num, s.vadd_num, s.peak_rss, s.raw_bytes);
+        for (size_t j = 0; j < s.bytes_sent.size(); j++)
+            fprintf(f, ",%lld", s.bytes_sent[j]);
+        fprintf(f, "\n");
+    }
+}
+
+void write_metrics_json(FILE* f, vector<StepMetrics>& all)
+{
+    fprintf(f, "{\n  \"num_workers\": %d,\n  \"steps\": [", _num_workers);
+    for (size_t i = 0; i < all.size(); i++) {
+        StepMetrics& s = all[i];
+        fprintf(f, "%s\n    {\"phase\": \"%s\", \"step\": %d, \"worker\": %d, "
+                   "\"active_compute\": %f, \"sync_message\": %f, "
+                   "\"serialization\": %f, \"transfer\": %f, \"sync\": %f, "
+                   "\"compress\": %f, \"msg_num\": %lld, \"vadd_num\": %lld, "
+                   "\"peak_rss_kb\": %lld, \"raw_bytes\": %lld, \"bytes_sent\": [",
+            (i == 0 ? "" : ","), phase_name(s.phase), s.step, s.worker,
+            s.active_compute, s.sync_message, s.serialization, s.transfer,
+            s.sync, s.compress, s.msg_num, s.vadd_num, s.peak_rss, s.raw_bytes);
+        for (size_t j = 0; j < s.bytes_sent.size(); j++)
+            fprintf(f, "%s%lld", (j == 0 ? "" : ", "), s.bytes_sent[j]);
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+//format is decided by the extension: ".json" for JSON, otherwise CSV
+void write_metrics(const string& path, vector<StepMetrics>& all)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s for writing metrics!\n", path.c_str());
+        return;
+    }
+    if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+        write_metrics_json(f, all);
+    else
+        write_metrics_csv(f, all);
+    fclose(f);
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+//Hot-path profiling zones, compiled in only with -DPROFILE_MODE (make profile).
+//Each thread accumulates into its own table, tables are summed and reduced
+//to MASTER by profile_report(), independently of the result aggregator.
+
+#include <time.h>
+#include <stdio.h>
+#include <mutex>
+#include <vector>
+#include "global.h"
+using namespace std;
+
+enum PROFILE_ZONES {
+    // MATCH (SIVertex::compute)
+    ZONE_ARRANGE_MESSAGES = 0,
+    ZONE_MAIN_COMPUTATION = 1,
+    ZONE_CHECK_FEASIBILITY = 2,
+    ZONE_CHECK_BRANCH = 3,
+    ZONE_CHECK_LEAF = 4,
+    ZONE_CHECK_OTHER = 5,
+    ZONE_CONTINUE_MAPPING = 6,
+    ZONE_NEIGHBOR_MAP = 7,
+    ZONE_OUT_MESSAGES = 8,
+    // ENUMERATE (SIVertex::enumerate, build_branch)
+    ZONE_ENUM_LEAF = 9,
+    ZONE_ENUM_DUMMY = 10,
+    ZONE_ORGANIZE_BRANCHES = 11,
+    ZONE_ENUMERATE_TREES = 12,
+    ZONE_SEND_OR_EXPAND = 13,
+    ZONE_SEND_TO_DUMMY = 14,
+    ZONE_EXPAND = 15,
+
+    N_ZONES = 16
+};
+
+const char* _zone_names[N_ZONES] = {
+    "1. Arrange messages",
+    "2. Main computation",
+    "2.1. Check feasibility",
+    "2.1.1. - branch vertices",
+    "2.1.2. - leaf vertices",
+    "2.1.3. - not-branch-nor-leaf vertices",
+    "2.2. Continue mapping",
+    "2.2.1. - construct neighbor map",
+    "2.2.2. - update out messages buffer",
+    "a) Leaf vertices",
+    "b) Dummy vertices",
+    "1. Organize branches",
+    "2. Enumerate trees",
+    "3. Send to dummies or expand",
+    "3.1. - send to dummies",
+    "3.2. - expand"
+};
+
+#define PROFILE_HIST_BINS 32 //bin i: [2^i, 2^(i+1)) nanoseconds
+#define PROFILE_SAMPLE_MASK 7 //one in 8 calls goes into the histogram
+
+inline long long profile_now()
+{ //nanoseconds
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+#ifdef PROFILE_MODE
+
+struct ZoneTable {
+    long long count[N_ZONES];
+    long long ns[N_ZONES];
+    long long hist[N_ZONES][PROFILE_HIST_BINS];
+
+    ZoneTable()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (int z = 0; z < N_ZONES; z++) {
+            count[z] = ns[z] = 0;
+            for (int b = 0; b < PROFILE_HIST_BINS; b++)
+                hist[z][b] = 0;
+        }
+    }
+
+    inline void add(int z, long long t)
+    {
+        ns[z] += t;
+        if ((count[z]++ & PROFILE_SAMPLE_MASK) == 0) {
+            int b = 0;
+            while (t > 1 && b < PROFILE_HIST_BINS - 1) {
+                t >>= 1;
+                b++;
+            }
+            hist[z][b]++;
+        }
+    }
+
+    void merge(const ZoneTable& o)
+    {
+        for (int z = 0; z < N_ZONES; z++) {
+            count[z] += o.count[z];
+            ns[z] += o.ns[z];
+            for (int b = 0; b < PROFILE_HIST_BINS; b++)
+                hist[z][b] += o.hist[z][b];
+        }
+    }
+};
+
+//live tables of all threads of this worker, plus those of exited threads
+WORKER_LOCAL(vector<ZoneTable*>, _zone_tables);
+WORKER_LOCAL(ZoneTable, _retired_zones);
+WORKER_LOCAL(mutex, _zone_tables_mutex);
+
+struct ThreadZoneTable : public ZoneTable {
+    ThreadZoneTable()
+    {
+        lock_guard<mutex> lock(_zone_tables_mutex);
+        _zone_tables.push_back(this);
+    }
+
+    ~ThreadZoneTable()
+    {
+        lock_guard<mutex> lock(_zone_tables_mutex);
+        _retired_zones.merge(*this);
+        for (size_t i = 0; i < _zone_tables.size(); i++)
+            if (_zone_tables[i] == this) {
+                _zone_tables.erase(_zone_tables.begin() + i);
+                break;
+            }
+    }
+};
+
+thread_local ThreadZoneTable _zone_table;
+
+//scoped zone: accumulates the time until the end of the enclosing block
+struct ProfileScope {
+    int zone;
+    long long start;
+
+    ProfileScope(int z)
+        : zone(z)
+        , start(profile_now())
+    {
+    }
+
+    ~ProfileScope()
+    {
+        _zone_table.add(zone, profile_now() - start);
+    }
+};
+
+#define PROFILE_SCOPE(z) ProfileScope _profile_scope_##z((z));
+#define PROFILE_BEGIN(z) long long _profile_start_##z = profile_now();
+#define PROFILE_END(z) _zone_table.add((z), profile_now() - _profile_start_##z);
+
+void profile_reset()
+{
+    lock_guard<mutex> lock(_zone_tables_mutex);
+    for (size_t i = 0; i < _zone_tables.size(); i++)
+        _zone_tables[i]->clear();
+    _retired_zones.clear();
+}
+
+//upper bound (in microseconds) of the histogram bin holding quantile q
+double profile_quantile(long long* hist, double q)
+{
+    long long total = 0, acc = 0;
+    for (int b = 0; b < PROFILE_HIST_BINS; b++)
+        total += hist[b];
+    if (total == 0)
+        return 0;
+    for (int b = 0; b < PROFILE_HIST_BINS; b++) {
+        acc += hist[b];
+        if (acc >= q * total)
+            return (double)(1LL << (b + 1)) / 1000;
+    }
+    return (double)(1LL << PROFILE_HIST_BINS) / 1000;
+}
+
+//sum the zones of all threads and all workers, MASTER prints zones in
+//[first, last); collective, every worker must call it
+void profile_report(const char* title, int first, int last)
+{
+    ZoneTable global;
+    {
+        lock_guard<mutex> lock(_zone_tables_mutex);
+        for (size_t i = 0; i < _zone_tables.size(); i++)
+            global.merge(*_zone_tables[i]);
+        global.merge(_retired_zones);
+    }
+    int n = sizeof(ZoneTable) / sizeof(long long);
+    get_transport().reduce(&global, n, RED_LL, RED_SUM, MASTER_RANK);
+    if (_my_rank == MASTER_RANK) {
+        printf("[Profile] %s (summed over %d workers)\n", title, _num_workers);
+        printf("%-40s %12s %12s %10s %10s %10s\n", "zone", "count",
+            "total (s)", "mean (us)", "p50 (us)", "p99 (us)");
+        for (int z = first; z < last; z++) {
+            double mean = global.count[z] == 0 ? 0
+                : (double)global.ns[z] / global.count[z] / 1000;
+            printf("%-40s %12lld %12f %10.3f %10.3f %10.3f\n", _zone_names[z],
+                global.count[z], (double)global.ns[z] / 1e9, mean,
+                profile_quantile(global.hist[z], 0.5),
+                profile_quantile(global.hist[z], 0.99));
+        }
+    }
+}
+
+#else
+
+#define PROFILE_SCOPE(z)
+#define PROFILE_BEGIN(z)
+#define PROFILE_END(z)
+
+inline void profile_reset() {}
+inline void profile_report(const char*, int, int) {}
+
+#endif
+
+#endif
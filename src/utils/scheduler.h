@@ -0,0 +1,296 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+//Work-stealing task scheduler, used by active_compute with -threads > 1.
+//Every thread owns a deque of tasks: it pops its own tasks from the back
+//(the most recent, cache-warm ones) and, when idle, steals from the front
+//of the other deques (the oldest ones). A running task may fork subtasks
+//with parallel_for(): they are pushed on the deque of its thread, where
+//idle threads steal them, and the forking thread runs them too until the
+//whole range is done.
+//The scheduler is a pool kept by its worker across supersteps: its
+//threads are started once, and wait on condition variables between
+//supersteps and while there is nothing to steal.
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "worker_local.h"
+using namespace std;
+
+#define TASKS_PER_THREAD 16 //initial tasks per thread, stealing does the rest
+
+struct TaskGroup {
+    atomic<int> pending; //#forked tasks not finished yet
+
+    TaskGroup()
+        : pending(0)
+    {
+    }
+};
+
+struct Task {
+    function<void()> run;
+    TaskGroup* group; //NULL for top-level tasks
+
+    Task()
+        : group(NULL)
+    {
+    }
+
+    Task(const function<void()>& f, TaskGroup* g)
+        : run(f)
+        , group(g)
+    {
+    }
+};
+
+class TaskScheduler;
+
+//the scheduler running the current superstep, NULL when sequential
+WORKER_LOCAL(TaskScheduler*, _active_scheduler);
+//index of the current thread in _active_scheduler, -1 outside of it
+thread_local int _task_thread = -1;
+
+class TaskScheduler {
+    struct TaskDeque {
+        mutex m;
+        deque<Task> tasks;
+    };
+
+    int n;
+    vector<TaskDeque> deques;
+    atomic<long long> unfinished; //#spawned tasks not finished yet
+    WorkerContext* worker; //of the thread that runs the scheduler
+    vector<thread> helpers; //threads 1..n-1
+
+    //superstep start and end, under pool_m
+    mutex pool_m;
+    condition_variable start_cv, done_cv;
+    long long superstep; //bumped by run() to start the helpers
+    int helpers_done; //#helpers done with the current superstep
+    bool stopping;
+    const function<void(int)>* enter; //of the current superstep
+
+    //parking of idle threads: events counts the spawns and the completions
+    //of groups and supersteps, a thread parks until it changes
+    mutex park_m;
+    condition_variable park_cv;
+    atomic<long long> events;
+    atomic<int> parked;
+
+    //internal use only!
+    void wake()
+    {
+        events++;
+        if (parked > 0) {
+            lock_guard<mutex> lock(park_m);
+            park_cv.notify_all();
+        }
+    }
+
+    //internal use only! waits for an event after seen, or for done()
+    template <class Done>
+    void park(long long seen, Done done)
+    {
+        parked++;
+        {
+            unique_lock<mutex> lock(park_m);
+            park_cv.wait(lock, [&]() { return events != seen || done(); });
+        }
+        parked--;
+    }
+
+    //internal use only!
+    void helper(int t)
+    {
+        adopt_worker(worker);
+        long long seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(pool_m);
+                start_cv.wait(lock, [&]() { return stopping || superstep != seen; });
+                if (stopping)
+                    return;
+                seen = superstep;
+            }
+            work(t, *enter);
+            {
+                lock_guard<mutex> lock(pool_m);
+                helpers_done++;
+            }
+            done_cv.notify_one();
+        }
+    }
+
+public:
+    TaskScheduler(int threads)
+        : n(threads)
+        , deques(threads)
+        , unfinished(0)
+        , worker(current_worker())
+        , superstep(0)
+        , helpers_done(0)
+        , stopping(false)
+        , enter(NULL)
+        , events(0)
+        , parked(0)
+    {
+        for (int t = 1; t < n; t++)
+            helpers.push_back(thread(&TaskScheduler::helper, this, t));
+    }
+
+    ~TaskScheduler()
+    {
+        {
+            lock_guard<mutex> lock(pool_m);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (size_t i = 0; i < helpers.size(); i++)
+            helpers[i].join();
+    }
+
+    int num_threads()
+    {
+        return n;
+    }
+
+    void spawn(int t, const Task& task)
+    {
+        unfinished++;
+        {
+            lock_guard<mutex> lock(deques[t].m);
+            deques[t].tasks.push_back(task);
+        }
+        wake();
+    }
+
+    //internal use only!
+    bool pop(int t, Task& task)
+    {
+        lock_guard<mutex> lock(deques[t].m);
+        if (deques[t].tasks.empty())
+            return false;
+        task = deques[t].tasks.back();
+        deques[t].tasks.pop_back();
+        return true;
+    }
+
+    //internal use only!
+    bool steal(int t, Task& task)
+    {
+        for (int i = 1; i < n; i++) {
+            TaskDeque& d = deques[(t + i) % n];
+            lock_guard<mutex> lock(d.m);
+            if (!d.tasks.empty()) {
+                task = d.tasks.front();
+                d.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //internal use only!
+    void execute(Task& task)
+    {
+        task.run();
+        bool group_done = task.group != NULL && --task.group->pending == 0;
+        if (--unfinished == 0 || group_done)
+            wake();
+    }
+
+    //internal use only!
+    void work(int t, const function<void(int)>& enter)
+    {
+        _task_thread = t;
+        enter(t);
+        Task task;
+        while (unfinished > 0) {
+            long long seen = events;
+            if (pop(t, task) || steal(t, task))
+                execute(task);
+            else
+                park(seen, [&]() { return unfinished == 0; });
+        }
+        _task_thread = -1;
+    }
+
+    //runs the spawned tasks on n threads (the caller is thread 0) until all
+    //of them and their subtasks are done; enter(t) is called first by every
+    //thread, e.g. to set up thread-local state
+    void run(const function<void(int)>& enter)
+    {
+        _active_scheduler = this;
+        {
+            lock_guard<mutex> lock(pool_m);
+            this->enter = &enter;
+            helpers_done = 0;
+            superstep++;
+        }
+        start_cv.notify_all();
+        work(0, enter);
+        {
+            unique_lock<mutex> lock(pool_m);
+            done_cv.wait(lock, [&]() { return helpers_done == n - 1; });
+        }
+        _active_scheduler = NULL;
+    }
+
+    //forks the tasks of group on the deque of thread t and runs them there
+    //until all are done; the thread only pops tasks of its own group, so the
+    //caller's state cannot be entered again meanwhile
+    void fork_join(int t, vector<function<void()> >& fns, TaskGroup& group)
+    {
+        group.pending += fns.size();
+        for (size_t i = 0; i < fns.size(); i++)
+            spawn(t, Task(fns[i], &group));
+        Task task;
+        while (group.pending > 0) {
+            long long seen = events;
+            bool mine = false;
+            {
+                lock_guard<mutex> lock(deques[t].m);
+                deque<Task>& tasks = deques[t].tasks;
+                if (!tasks.empty() && tasks.back().group == &group) {
+                    task = tasks.back();
+                    tasks.pop_back();
+                    mine = true;
+                }
+            }
+            if (mine)
+                execute(task);
+            else
+                park(seen, [&]() { return group.pending == 0; });
+        }
+    }
+};
+
+//calls f(first, last) on the ranges [first, last) of [0, n), cut at
+//multiples of grain; the ranges run as stealable tasks inside a parallel
+//superstep and in a plain loop otherwise
+template <class F>
+void parallel_for(int n, int grain, F f)
+{
+    TaskScheduler* sched = _active_scheduler;
+    if (sched == NULL || _task_thread < 0 || n <= grain) {
+        if (n > 0)
+            f(0, n);
+        return;
+    }
+    vector<function<void()> > fns;
+    for (int first = 0; first < n; first += grain) {
+        int last = min(n, first + grain);
+        fns.push_back([&f, first, last]() { f(first, last); });
+    }
+    TaskGroup group;
+    sched->fork_join(_task_thread, fns, group);
+}
+
+#endif
@@ -7,33 +7,86 @@
 #include <set>
 #include <string>
 #include <map>
+#include <algorithm>
+#include <string.h>
 #include "global.h"
 
 using namespace std;
 
 class ibinstream {
 private:
-    vector<char> buf;
+    char* buf; //new[], so that release() can hand it over
+    size_t len;
+    size_t cap;
+
+    void reserve(size_t need)
+    {
+        if (need <= cap)
+            return;
+        size_t c = max(need, 2 * cap);
+        char* b = new char[c];
+        if (len > 0)
+            memcpy(b, buf, len);
+        delete[] buf;
+        buf = b;
+        cap = c;
+    }
 
 public:
+    ibinstream()
+        : buf(NULL)
+        , len(0)
+        , cap(0)
+    {
+    }
+
+    ibinstream(ibinstream&& m)
+        : buf(m.buf)
+        , len(m.len)
+        , cap(m.cap)
+    {
+        m.buf = NULL;
+        m.len = m.cap = 0;
+    }
+
+    ibinstream(const ibinstream&) = delete;
+    ibinstream& operator=(const ibinstream&) = delete;
+
+    ~ibinstream()
+    {
+        delete[] buf;
+    }
+
     char* get_buf()
     {
-        return &buf[0];
+        return buf;
     }
 
     size_t size()
     {
-        return buf.size();
+        return len;
+    }
+
+    //hands the buffer over to the caller (delete[] it), the stream is left empty
+    char* release()
+    {
+        char* b = buf;
+        buf = NULL;
+        len = cap = 0;
+        return b;
     }
 
     void raw_byte(char c)
     {
-        buf.push_back(c);
+        reserve(len + 1);
+        buf[len++] = c;
     }
 
-    void raw_bytes(const void* ptr, int size)
+    void raw_bytes(const void* ptr, size_t size)
     {
-        buf.insert(buf.end(), (const char*)ptr, (const char*)ptr + size);
+        reserve(len + size);
+        memcpy(buf + len, ptr, size);
+        len += size;
     }
 };
 
@@ -55,6 +108,12 @@ ibinstream& operator<<(ibinstream& m, int i)
     return m;
 }
 
+ibinstream& operator<<(ibinstream& m, long long i)
+{
+    m.raw_bytes(&i, sizeof(long long));
+    return m;
+}
+
 ibinstream& operator<<(ibinstream& m, double i)
 {
     m.raw_bytes(&i, sizeof(double));
@@ -160,19 +219,28 @@ private:
     char* buf; //responsible for deleting the buffer, do not delete outside
     size_t size;
     size_t index;
+    bool own; //false: buf belongs to someone else, e.g. shared memory
 
 public:
     obinstream(char* b, size_t s)
         : buf(b)
         , size(s)
-        , index(0) {};
+        , index(0)
+        , own(true) {};
     obinstream(char* b, size_t s, size_t idx)
         : buf(b)
         , size(s)
-        , index(idx) {};
+        , index(idx)
+        , own(true) {};
+    obinstream(char* b, size_t s, size_t idx, bool o)
+        : buf(b)
+        , size(s)
+        , index(idx)
+        , own(o) {};
     ~obinstream()
     {
-        delete[] buf;
+        if (own)
+            delete[] buf;
     }
 
     char raw_byte()
@@ -180,7 +248,7 @@ public:
         return buf[index++];
     }
 
-    void* raw_bytes(unsigned int n_bytes)
+    void* raw_bytes(size_t n_bytes)
     {
         char* ret = buf + index;
         index += n_bytes;
@@ -206,6 +274,12 @@ obinstream& operator>>(obinstream& m, int& i)
     return m;
 }
 
+obinstream& operator>>(obinstream& m, long long& i)
+{
+    i = *(long long*)m.raw_bytes(sizeof(long long));
+    return m;
+}
+
 obinstream& operator>>(obinstream& m, double& i)
 {
     i = *(double*)m.raw_bytes(sizeof(double));
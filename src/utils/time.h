@@ -5,6 +5,7 @@
 
 #include <sys/time.h>
 #include <stdio.h>
+#include "worker_local.h"
 
 #define StartTimer(i) start_timer((i))
 #define StopTimer(i) stop_timer((i))
@@ -21,9 +22,10 @@ double get_current_time()
     return (double)t.tv_sec + (double)t.tv_usec / 1000000;
 }
 
-const int N_Timers = 18;
-static double _timers[N_Timers]; // timers
-static double _acc_time[N_Timers]; // accumulated time
+const int N_Timers = 19;
+typedef double Timers[N_Timers];
+WORKER_LOCAL(Timers, _timers); // timers
+WORKER_LOCAL(Timers, _acc_time); // accumulated time
 
 void init_timers()
 {
@@ -56,8 +58,9 @@ enum TIMERS {
     COMMUNICATION_TIMER = 14,
     SERIALIZATION_TIMER = 15,
     TRANSFER_TIMER = 16,
+    COMPRESS_TIMER = 17,
 
-    TMP_TIMER = 17
+    TMP_TIMER = 18
 };
 
 void start_timer(int i)
@@ -0,0 +1,274 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+//Allocation-free tokenizer of the text input, and the label dictionary.
+//A label is any token without blanks ("a", "Person", "42"); it is
+//interned into a dictionary and replaced by an int ID. Loader threads
+//intern through a private cache, so the shared dictionary is locked once
+//per distinct label and thread only.
+
+#include <string.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "communication.h"
+#include "global.h"
+using namespace std;
+
+//====== Tokens ======
+
+//' ', '\t', '\r', '\n' and '\0' are all <= ' ', one compare per byte
+inline bool is_blank(char c)
+{
+    return (unsigned char)c <= ' ';
+}
+
+inline char* skip_blanks(char* p)
+{
+    while (*p != '\0' && is_blank(*p))
+        p++;
+    return p;
+}
+
+//returns the end of the token starting at p
+inline char* token_end(char* p)
+{
+    while (!is_blank(*p))
+        p++;
+    return p;
+}
+
+//branch-light decimal parsing, returns the first byte after the digits
+inline char* parse_int(char* p, int& x)
+{
+    bool neg = (*p == '-');
+    p += neg;
+    unsigned int v = 0, d;
+    while ((d = (unsigned int)(*p - '0')) < 10) {
+        v = v * 10 + d;
+        p++;
+    }
+    x = neg ? -(int)v : (int)v;
+    return p;
+}
+
+//====== Dictionary ======
+
+//string <-> index, indices are given in the order of insertion
+struct LabelDict {
+    vector<char> arena; //label bytes, back to back
+    vector<int> offsets; //index -> start in arena, offsets[size()] = arena end
+    vector<int> slots; //open addressing, index + 1, 0 for empty
+
+    LabelDict()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        arena.clear();
+        offsets.assign(1, 0);
+        slots.assign(16, 0);
+    }
+
+    int size() const
+    {
+        return offsets.size() - 1;
+    }
+
+    string name(int i) const
+    {
+        return string(arena.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    //internal use only!
+    static uint32_t hash(const char* s, int len)
+    { //FNV-1a
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < len; i++)
+            h = (h ^ (unsigned char)s[i]) * 16777619u;
+        return h;
+    }
+
+    //internal use only!
+    bool equals(int i, const char* s, int len) const
+    {
+        return offsets[i + 1] - offsets[i] == len
+            && memcmp(arena.data() + offsets[i], s, len) == 0;
+    }
+
+    //internal use only!
+    void rehash()
+    {
+        slots.assign(slots.size() * 2, 0);
+        size_t mask = slots.size() - 1;
+        for (int i = 0; i < size(); i++) {
+            size_t pos = hash(arena.data() + offsets[i], offsets[i + 1] - offsets[i]) & mask;
+            while (slots[pos] != 0)
+                pos = (pos + 1) & mask;
+            slots[pos] = i + 1;
+        }
+    }
+
+    //returns -1 if not found
+    int find(const char* s, int len) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t pos = hash(s, len) & mask;
+        while (slots[pos] != 0) {
+            if (equals(slots[pos] - 1, s, len))
+                return slots[pos] - 1;
+            pos = (pos + 1) & mask;
+        }
+        return -1;
+    }
+
+    int intern(const char* s, int len)
+    {
+        int i = find(s, len);
+        if (i >= 0)
+            return i;
+        if ((size() + 1) * 2 > (int)slots.size())
+            rehash();
+        i = size();
+        arena.insert(arena.end(), s, s + len);
+        offsets.push_back(arena.size());
+        size_t mask = slots.size() - 1;
+        size_t pos = hash(s, len) & mask;
+        while (slots[pos] != 0)
+            pos = (pos + 1) & mask;
+        slots[pos] = i + 1;
+        return i;
+    }
+
+    int intern(const string& s)
+    {
+        return intern(s.c_str(), s.size());
+    }
+
+    vector<string> names() const
+    {
+        vector<string> v;
+        for (int i = 0; i < size(); i++)
+            v.push_back(name(i));
+        return v;
+    }
+};
+
+//the label dictionary of this worker, label ID = index
+//after sync_label_dict(), identical on all workers (the query loader may
+//append labels absent from the data graph on MASTER_RANK)
+WORKER_LOCAL(LabelDict, global_label_dict);
+WORKER_LOCAL(int, global_label_dict_gen); //bumped whenever the IDs change
+WORKER_LOCAL(mutex, _label_dict_mutex);
+
+//per-thread cache: label -> ID in global_label_dict
+struct LabelCache {
+    LabelDict dict;
+    vector<int> ids;
+    int gen;
+
+    LabelCache()
+        : gen(0)
+    {
+    }
+};
+
+thread_local LabelCache _label_cache;
+
+inline int get_label_id(const char* s, int len)
+{
+    LabelCache& cache = _label_cache;
+    if (cache.gen != global_label_dict_gen) {
+        cache.dict.clear();
+        cache.ids.clear();
+        cache.gen = global_label_dict_gen;
+    }
+    int i = cache.dict.find(s, len);
+    if (i >= 0)
+        return cache.ids[i];
+    int id;
+    {
+        lock_guard<mutex> lock(_label_dict_mutex);
+        id = global_label_dict.intern(s, len);
+    }
+    cache.dict.intern(s, len);
+    cache.ids.push_back(id);
+    return id;
+}
+
+//parses the label token at p, returns the first byte after it
+inline char* parse_label(char* p, int& label)
+{
+    char* e = token_end(p);
+    label = get_label_id(p, e - p);
+    return e;
+}
+
+inline string get_label_name(int label)
+{
+    if (label < 0 || label >= global_label_dict.size())
+        return "?";
+    return global_label_dict.name(label);
+}
+
+//global frequency histogram, label ID -> #data vertices
+WORKER_LOCAL(vector<long long>, global_label_freq);
+
+inline long long get_label_freq(int label)
+{
+    if (label < 0 || label >= (int)global_label_freq.size())
+        return 0; //e.g. a label only in the query graph
+    return global_label_freq[label];
+}
+
+//label dictionary pass, collective (every worker must call it) after the
+//data graph is loaded: unifies the dictionaries of all workers into dense
+//IDs 0, 1, ... in descending order of frequency, and fills
+//global_label_freq; counts[i] = #loaded vertices of (old) label i.
+//Returns the translation old ID -> new ID of this worker.
+vector<int> sync_label_dict(const vector<long long>& counts)
+{
+    vector<string> mine = global_label_dict.names();
+    vector<pair<long long, string> > freq; //(-count, label) by new ID
+    if (_my_rank == MASTER_RANK) {
+        vector<vector<string> > parts(_num_workers);
+        vector<vector<long long> > part_counts(_num_workers);
+        masterGather(parts);
+        masterGather(part_counts);
+        parts[MASTER_RANK] = mine;
+        part_counts[MASTER_RANK] = counts;
+        LabelDict merged;
+        for (int i = 0; i < _num_workers; i++)
+            for (size_t j = 0; j < parts[i].size(); j++) {
+                int id = merged.intern(parts[i][j]);
+                if (id == (int)freq.size())
+                    freq.push_back(make_pair(0LL, parts[i][j]));
+                freq[id].first -= part_counts[i][j];
+            }
+        sort(freq.begin(), freq.end());
+        masterBcast(freq);
+    } else {
+        slaveGather(mine);
+        vector<long long> c = counts;
+        slaveGather(c);
+        slaveBcast(freq);
+    }
+    LabelDict dense;
+    global_label_freq.resize(freq.size());
+    for (size_t i = 0; i < freq.size(); i++) {
+        dense.intern(freq[i].second);
+        global_label_freq[i] = -freq[i].first;
+    }
+    vector<int> trans(mine.size());
+    for (size_t i = 0; i < mine.size(); i++)
+        trans[i] = dense.find(mine[i].c_str(), mine[i].size());
+    global_label_dict = dense;
+    global_label_dict_gen++;
+    return trans;
+}
+
+#endif
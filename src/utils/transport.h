@@ -0,0 +1,518 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+//Transport between the workers, behind communication.h: point-to-point
+//buffers and the collectives. Two backends:
+//- MpiTransport (default): a worker is an MPI process, MPI_COMM_WORLD
+//- ThreadTransport (built with -DTHREAD_TRANSPORT): the workers are
+//  threads of one process (see run_workers in global.h), no MPI startup.
+//  A buffer goes through the queue of its (sender, receiver) pair, where
+//  the receiver takes it over: one given with send_owned (as every
+//  send_ibinstream does) is never copied. A collective reads the buffers
+//  of the other workers in place.
+//Every worker must call the collectives in the same order.
+
+#include <mpi.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "worker_local.h"
+using namespace std;
+
+enum REDUCE_TYPES {
+    RED_CHAR = 0,
+    RED_INT = 1,
+    RED_LL = 2 //long long
+};
+
+enum REDUCE_OPS {
+    RED_SUM = 0,
+    RED_BOR = 1
+};
+
+class Transport {
+public:
+    virtual ~Transport()
+    {
+    }
+
+    virtual int rank() = 0;
+    virtual int size() = 0;
+    //whether all workers are in this process
+    virtual bool in_process() = 0;
+
+    //============================================
+    //point-to-point, in order between a pair of workers
+    virtual void send(const void* buf, size_t size, int dst) = 0;
+    virtual void recv(void* buf, size_t size, int src) = 0;
+
+    //sends buf, a new[] buffer the transport takes over and deletes
+    virtual void send_owned(char* buf, size_t size, int dst)
+    {
+        send(buf, size, dst);
+        delete[] buf;
+    }
+
+    //receives size bytes from src into a new[] buffer, the caller owns it
+    virtual char* recv_new(size_t size, int src)
+    {
+        char* buf = new char[size];
+        recv(buf, size, src);
+        return buf;
+    }
+
+    //============================================
+    //collectives
+    virtual void barrier() = 0;
+    //buf = the count values of type in buf, combined by op over all workers
+    virtual void allreduce(void* buf, int count, int type, int op) = 0;
+    //the same, on root only
+    virtual void reduce(void* buf, int count, int type, int op, int root) = 0;
+    //buf = the POD of size bytes in buf, combined over all workers by op,
+    //an MPI_User_function (called with len = 1) associative and commutative
+    virtual void allreduce_pod(void* buf, int size, MPI_User_function* op) = 0;
+    virtual void bcast(void* buf, size_t size, int root) = 0;
+    //block i of send (bytes each) to worker i, into block j of recv from worker j
+    virtual void alltoall(const void* send, void* recv, int bytes) = 0;
+    //block i of recv = send of worker i, on root
+    virtual void gather(const void* send, void* recv, int bytes, int root) = 0;
+    //counts[i] bytes at displs[i] of recv = send of worker i, on root
+    virtual void gatherv(const void* send, int count, void* recv,
+        const int* counts, const int* displs, int root) = 0;
+    //recv = block i of send of root, on worker i
+    virtual void scatter(const void* send, void* recv, int bytes, int root) = 0;
+    //recv = the count bytes at displs[i] of send of root, on worker i
+    virtual void scatterv(const void* send, const int* counts, const int* displs,
+        void* recv, int count, int root) = 0;
+};
+
+WORKER_LOCAL(Transport*, _transport);
+
+inline Transport& get_transport()
+{
+    return *_transport;
+}
+
+inline int reduce_type_size(int type)
+{
+    if (type == RED_CHAR)
+        return sizeof(char);
+    if (type == RED_INT)
+        return sizeof(int);
+    return sizeof(long long);
+}
+
+//============================================
+//MPI
+//MPI counts are ints: a buffer larger than COMM_CHUNK bytes is cut into
+//chunks that are all in flight at once (MPI keeps their order), so that
+//a buffer of any size_t length goes through
+#ifndef COMM_CHUNK
+#define COMM_CHUNK (1 << 30)
+#endif
+
+class MpiTransport : public Transport {
+    int me;
+    int n;
+
+    static MPI_Datatype mpi_type(int type)
+    {
+        if (type == RED_CHAR)
+            return MPI_BYTE;
+        if (type == RED_INT)
+            return MPI_INT;
+        return MPI_LONG_LONG_INT;
+    }
+
+    static MPI_Op mpi_op(int op)
+    {
+        return op == RED_BOR ? MPI_BOR : MPI_SUM;
+    }
+
+public:
+    MpiTransport()
+    {
+        MPI_Comm_rank(MPI_COMM_WORLD, &me);
+        MPI_Comm_size(MPI_COMM_WORLD, &n);
+    }
+
+    int rank()
+    {
+        return me;
+    }
+
+    int size()
+    {
+        return n;
+    }
+
+    bool in_process()
+    {
+        return false;
+    }
+
+    void send(const void* buf, size_t size, int dst)
+    {
+        if (size <= COMM_CHUNK) {
+            MPI_Send(buf, (int)size, MPI_CHAR, dst, 0, MPI_COMM_WORLD);
+            return;
+        }
+        int k = (size + COMM_CHUNK - 1) / COMM_CHUNK;
+        vector<MPI_Request> reqs(k);
+        for (int i = 0; i < k; i++) {
+            size_t pos = (size_t)i * COMM_CHUNK;
+            int len = (int)min((size_t)COMM_CHUNK, size - pos);
+            MPI_Isend((char*)buf + pos, len, MPI_CHAR, dst, 0, MPI_COMM_WORLD, &reqs[i]);
+        }
+        MPI_Waitall(k, &reqs[0], MPI_STATUSES_IGNORE);
+    }
+
+    void recv(void* buf, size_t size, int src)
+    {
+        if (size <= COMM_CHUNK) {
+            MPI_Recv(buf, (int)size, MPI_CHAR, src, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            return;
+        }
+        int k = (size + COMM_CHUNK - 1) / COMM_CHUNK;
+        vector<MPI_Request> reqs(k);
+        for (int i = 0; i < k; i++) {
+            size_t pos = (size_t)i * COMM_CHUNK;
+            int len = (int)min((size_t)COMM_CHUNK, size - pos);
+            MPI_Irecv((char*)buf + pos, len, MPI_CHAR, src, 0, MPI_COMM_WORLD, &reqs[i]);
+        }
+        MPI_Waitall(k, &reqs[0], MPI_STATUSES_IGNORE);
+    }
+
+    void barrier()
+    {
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    void allreduce(void* buf, int count, int type, int op)
+    {
+        MPI_Allreduce(MPI_IN_PLACE, buf, count, mpi_type(type), mpi_op(op), MPI_COMM_WORLD);
+    }
+
+    void reduce(void* buf, int count, int type, int op, int root)
+    {
+        if (me == root)
+            MPI_Reduce(MPI_IN_PLACE, buf, count, mpi_type(type), mpi_op(op), root, MPI_COMM_WORLD);
+        else
+            MPI_Reduce(buf, NULL, count, mpi_type(type), mpi_op(op), root, MPI_COMM_WORLD);
+    }
+
+    void allreduce_pod(void* buf, int size, MPI_User_function* op)
+    {
+        MPI_Datatype type;
+        MPI_Type_contiguous(size, MPI_BYTE, &type);
+        MPI_Type_commit(&type);
+        MPI_Op pod_op;
+        MPI_Op_create(op, 1, &pod_op);
+        MPI_Allreduce(MPI_IN_PLACE, buf, 1, type, pod_op, MPI_COMM_WORLD);
+        MPI_Op_free(&pod_op);
+        MPI_Type_free(&type);
+    }
+
+    //chunked MPI_Bcast
+    void bcast(void* buf, size_t size, int root)
+    {
+        for (size_t pos = 0; pos < size; pos += COMM_CHUNK) {
+            int len = (int)min((size_t)COMM_CHUNK, size - pos);
+            MPI_Bcast((char*)buf + pos, len, MPI_CHAR, root, MPI_COMM_WORLD);
+        }
+    }
+
+    void alltoall(const void* send, void* recv, int bytes)
+    {
+        MPI_Alltoall(send, bytes, MPI_BYTE, recv, bytes, MPI_BYTE, MPI_COMM_WORLD);
+    }
+
+    void gather(const void* send, void* recv, int bytes, int root)
+    {
+        MPI_Gather(send, bytes, MPI_BYTE, recv, bytes, MPI_BYTE, root, MPI_COMM_WORLD);
+    }
+
+    void gatherv(const void* send, int count, void* recv,
+        const int* counts, const int* displs, int root)
+    {
+        MPI_Gatherv(send, count, MPI_CHAR, recv, counts, displs, MPI_CHAR, root, MPI_COMM_WORLD);
+    }
+
+    void scatter(const void* send, void* recv, int bytes, int root)
+    {
+        MPI_Scatter(send, bytes, MPI_BYTE, recv, bytes, MPI_BYTE, root, MPI_COMM_WORLD);
+    }
+
+    void scatterv(const void* send, const int* counts, const int* displs,
+        void* recv, int count, int root)
+    {
+        MPI_Scatterv(send, counts, displs, MPI_CHAR, recv, count, MPI_CHAR, root, MPI_COMM_WORLD);
+    }
+};
+
+//============================================
+//threads
+#ifdef THREAD_TRANSPORT
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+//a buffer in flight, new[]
+struct Parcel {
+    char* buf;
+    size_t size;
+};
+
+//the buffers sent by a worker to another one, in order
+struct Mailbox {
+    mutex m;
+    condition_variable cv;
+    deque<Parcel> parcels;
+};
+
+//shared by the workers of a process
+struct ThreadHub {
+    int n;
+    vector<Mailbox> boxes; //sender * n + receiver
+    //barrier
+    mutex m;
+    condition_variable cv;
+    int arrived;
+    long long round;
+    //worker -> what it publishes in the current collective
+    vector<const void*> slots;
+
+    ThreadHub(int workers)
+        : n(workers)
+        , boxes((size_t)workers * workers)
+        , arrived(0)
+        , round(0)
+        , slots(workers, NULL)
+    {
+    }
+
+    ~ThreadHub()
+    {
+        for (size_t i = 0; i < boxes.size(); i++)
+            for (size_t j = 0; j < boxes[i].parcels.size(); j++)
+                delete[] boxes[i].parcels[j].buf;
+    }
+
+    void barrier()
+    {
+        unique_lock<mutex> lock(m);
+        long long r = round;
+        if (++arrived == n) {
+            arrived = 0;
+            round++;
+            cv.notify_all();
+        } else
+            cv.wait(lock, [&]() { return round != r; });
+    }
+};
+
+template <class T>
+void reduce_into(T* acc, const T* x, int count, int op)
+{
+    if (op == RED_BOR)
+        for (int i = 0; i < count; i++)
+            acc[i] |= x[i];
+    else
+        for (int i = 0; i < count; i++)
+            acc[i] += x[i];
+}
+
+class ThreadTransport : public Transport {
+    ThreadHub* hub;
+    int me;
+
+    //publishes mine, then once every worker has, read(slots) reads what
+    //the others published; returns when every worker is done reading
+    template <class Read>
+    void collective(const void* mine, Read read)
+    {
+        hub->slots[me] = mine;
+        hub->barrier();
+        read(hub->slots);
+        hub->barrier();
+    }
+
+    Parcel take(int src)
+    {
+        Mailbox& box = hub->boxes[(size_t)src * hub->n + me];
+        unique_lock<mutex> lock(box.m);
+        box.cv.wait(lock, [&]() { return !box.parcels.empty(); });
+        Parcel p = box.parcels.front();
+        box.parcels.pop_front();
+        return p;
+    }
+
+    //acc = the count values of type published by the workers, combined by op
+    void combine(const vector<const void*>& slots, char* acc, int count, int type, int op)
+    {
+        memcpy(acc, slots[0], (size_t)count * reduce_type_size(type));
+        for (int i = 1; i < hub->n; i++) {
+            if (type == RED_CHAR)
+                reduce_into(acc, (const char*)slots[i], count, op);
+            else if (type == RED_INT)
+                reduce_into((int*)acc, (const int*)slots[i], count, op);
+            else
+                reduce_into((long long*)acc, (const long long*)slots[i], count, op);
+        }
+    }
+
+public:
+    ThreadTransport(ThreadHub* h, int rank)
+        : hub(h)
+        , me(rank)
+    {
+    }
+
+    int rank()
+    {
+        return me;
+    }
+
+    int size()
+    {
+        return hub->n;
+    }
+
+    bool in_process()
+    {
+        return true;
+    }
+
+    void send(const void* buf, size_t size, int dst)
+    {
+        char* copy = new char[size];
+        memcpy(copy, buf, size);
+        send_owned(copy, size, dst);
+    }
+
+    //the receiver gets buf itself
+    void send_owned(char* buf, size_t size, int dst)
+    {
+        Parcel p;
+        p.buf = buf;
+        p.size = size;
+        Mailbox& box = hub->boxes[(size_t)me * hub->n + dst];
+        {
+            lock_guard<mutex> lock(box.m);
+            box.parcels.push_back(p);
+        }
+        box.cv.notify_one();
+    }
+
+    void recv(void* buf, size_t size, int src)
+    {
+        Parcel p = take(src);
+        memcpy(buf, p.buf, min(size, p.size));
+        delete[] p.buf;
+    }
+
+    char* recv_new(size_t size, int src)
+    {
+        return take(src).buf;
+    }
+
+    void barrier()
+    {
+        hub->barrier();
+    }
+
+    void allreduce(void* buf, int count, int type, int op)
+    {
+        vector<char> acc((size_t)count * reduce_type_size(type));
+        collective(buf, [&](const vector<const void*>& slots) {
+            combine(slots, &acc[0], count, type, op);
+        });
+        memcpy(buf, &acc[0], acc.size());
+    }
+
+    void reduce(void* buf, int count, int type, int op, int root)
+    {
+        vector<char> acc((size_t)count * reduce_type_size(type));
+        collective(buf, [&](const vector<const void*>& slots) {
+            if (me == root)
+                combine(slots, &acc[0], count, type, op);
+        });
+        if (me == root)
+            memcpy(buf, &acc[0], acc.size());
+    }
+
+    void allreduce_pod(void* buf, int size, MPI_User_function* op)
+    {
+        vector<char> acc(size);
+        collective(buf, [&](const vector<const void*>& slots) {
+            memcpy(&acc[0], slots[0], size);
+            int len = 1;
+            MPI_Datatype type = MPI_BYTE; //unused by the ops
+            for (int i = 1; i < hub->n; i++)
+                op((void*)slots[i], &acc[0], &len, &type);
+        });
+        memcpy(buf, &acc[0], size);
+    }
+
+    void bcast(void* buf, size_t size, int root)
+    {
+        collective(buf, [&](const vector<const void*>& slots) {
+            if (me != root)
+                memcpy(buf, slots[root], size);
+        });
+    }
+
+    void alltoall(const void* send, void* recv, int bytes)
+    {
+        collective(send, [&](const vector<const void*>& slots) {
+            for (int i = 0; i < hub->n; i++)
+                memcpy((char*)recv + (size_t)i * bytes,
+                    (const char*)slots[i] + (size_t)me * bytes, bytes);
+        });
+    }
+
+    void gather(const void* send, void* recv, int bytes, int root)
+    {
+        collective(send, [&](const vector<const void*>& slots) {
+            if (me == root)
+                for (int i = 0; i < hub->n; i++)
+                    memcpy((char*)recv + (size_t)i * bytes, slots[i], bytes);
+        });
+    }
+
+    void gatherv(const void* send, int count, void* recv,
+        const int* counts, const int* displs, int root)
+    {
+        collective(send, [&](const vector<const void*>& slots) {
+            if (me == root)
+                for (int i = 0; i < hub->n; i++)
+                    if (counts[i] > 0)
+                        memcpy((char*)recv + displs[i], slots[i], counts[i]);
+        });
+    }
+
+    void scatter(const void* send, void* recv, int bytes, int root)
+    {
+        collective(send, [&](const vector<const void*>& slots) {
+            memcpy(recv, (const char*)slots[root] + (size_t)me * bytes, bytes);
+        });
+    }
+
+    void scatterv(const void* send, const int* counts, const int* displs,
+        void* recv, int count, int root)
+    {
+        //root publishes its displacements along with its buffer
+        const void* mine[2] = { send, displs };
+        collective(mine, [&](const vector<const void*>& slots) {
+            const void* const* theirs = (const void* const*)slots[root];
+            const int* d = (const int*)theirs[1];
+            if (count > 0)
+                memcpy(recv, (const char*)theirs[0] + d[me], count);
+        });
+    }
+};
+
+#endif
+
+#endif
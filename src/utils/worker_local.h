@@ -0,0 +1,106 @@
+#ifndef WORKER_LOCAL_H
+#define WORKER_LOCAL_H
+
+//The state of a worker (its rank, timers, message buffer, label
+//dictionary...) is kept in globals declared with
+//WORKER_LOCAL(type, name, init...). With the MPI transport a worker is a
+//process, and they are plain globals. With the thread transport (built
+//with -DTHREAD_TRANSPORT, see transport.h) the workers are threads of one
+//process: name is then a thread_local reference to the instance of the
+//worker of the thread, made from init the first time a thread of that
+//worker needs it. A thread started by a worker (a loader or task thread)
+//must call adopt_worker(context of the worker) before anything else, to
+//share the instances of its worker.
+
+#ifdef THREAD_TRANSPORT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <mutex>
+#include <string>
+using namespace std;
+
+template <class T>
+struct WorkerLocalBox {
+    T value;
+
+    template <class... Init>
+    WorkerLocalBox(Init... init)
+        : value{ init... }
+    {
+    }
+};
+
+//the instances of the worker-local globals of one worker
+class WorkerContext {
+    mutex m;
+    map<string, pair<void*, void (*)(void*)> > locals; //name -> (box, deleter)
+
+public:
+    ~WorkerContext()
+    {
+        map<string, pair<void*, void (*)(void*)> >::iterator it;
+        for (it = locals.begin(); it != locals.end(); ++it)
+            it->second.second(it->second.first);
+    }
+
+    template <class T, class... Init>
+    T& local(const char* name, Init... init)
+    {
+        lock_guard<mutex> lock(m);
+        pair<void*, void (*)(void*)>& slot = locals[name];
+        if (slot.first == NULL) {
+            slot.first = new WorkerLocalBox<T>(init...);
+            slot.second = [](void* box) { delete (WorkerLocalBox<T>*)box; };
+        }
+        return ((WorkerLocalBox<T>*)slot.first)->value;
+    }
+};
+
+thread_local WorkerContext* _worker_context = NULL;
+
+inline WorkerContext* current_worker()
+{
+    return _worker_context;
+}
+
+inline void adopt_worker(WorkerContext* context)
+{
+    _worker_context = context;
+}
+
+inline WorkerContext* worker_context()
+{
+    if (_worker_context == NULL) {
+        fprintf(stderr, "Worker state used outside of a worker thread!\n");
+        exit(-1);
+    }
+    return _worker_context;
+}
+
+#define WORKER_LOCAL(type, name, ...) \
+    thread_local type& name = worker_context()->local<type>(#name, ##__VA_ARGS__)
+//declaration of a static data member, defined with WORKER_LOCAL
+#define WORKER_LOCAL_MEMBER(type, name) static thread_local type& name
+
+#else
+
+struct WorkerContext {
+};
+
+inline WorkerContext* current_worker()
+{
+    return NULL;
+}
+
+inline void adopt_worker(WorkerContext*)
+{
+}
+
+#define WORKER_LOCAL(type, name, ...) type name{ __VA_ARGS__ }
+#define WORKER_LOCAL_MEMBER(type, name) static type name
+
+#endif
+
+#endif